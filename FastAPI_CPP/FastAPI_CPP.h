@@ -5,6 +5,14 @@
 
 
 #include "http_lib.h"
+#include "http2.h"
+#include "websocket.h"
+#include "multipart.h"
+#include "json_cursor.h"
+#include "compression.h"
+#include "event_loop.h"
+#include "client.h"
+#include "trace.h"
 #include <functional>
 #include <vector>
 #include <memory>
@@ -12,27 +20,162 @@
 #include <atomic>
 #include <csignal>
 #include <regex>
+#include <fstream>
 #include <map>
+#include <unordered_map>
+#include <optional>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/un.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <cstring>
 #include <stdexcept>
+#include <chrono>
 
 namespace fastapi_cpp {
     using Request = http::Request;
     using Response = http::Response;
     using Method = http::Method;
+    // Path and query parameters. The map and its strings are allocated from the
+    // request's arena, so they are only valid during the handler call.
+    using Params = std::pmr::map<std::pmr::string, std::pmr::string, std::less<>>;
+    using Handler = std::function<Response(const Request&, const Params&)>;
+
+    // Consumer for a request body that is streamed instead of buffered:
+    // on_data receives the body in arbitrary chunks as it arrives, then
+    // on_complete builds the response.
+    struct BodyStream {
+        std::function<void(std::string_view chunk)> on_data;
+        std::function<Response()> on_complete;
+    };
+    using StreamHandler = std::function<BodyStream(const Request&, const Params&)>;
+
+    // Handler that answers later, e.g. after an http::Client call completes,
+    // by calling respond exactly once from the event loop thread. The request
+    // and params are only valid during the handler call.
+    using Responder = std::function<void(Response)>;
+    using AsyncHandler = std::function<void(const Request&, const Params&, Responder)>;
+
+    // Adds the request's query parameters, decoded, to params. Path parameters
+    // win over query parameters of the same name.
+    inline void add_query_params(const Request& request, Params& params) {
+        std::pmr::memory_resource* resource = params.get_allocator().resource();
+        for (const auto& entry : request.query_params.entries()) {
+            params.emplace(http::url_decode(entry.key, resource), http::url_decode(entry.value, resource));
+        }
+    }
+
+    // Regex results allocated from the request's arena. std::regex keeps its
+    // match state in a copy of the results, so this also moves most of the
+    // matcher's allocations off the global heap.
+    using PathMatch = std::match_results<std::string_view::const_iterator,
+            std::pmr::polymorphic_allocator<std::sub_match<std::string_view::const_iterator>>>;
+
+    inline bool match_path(std::string_view path, const std::regex& regex, PathMatch& match) {
+        return std::regex_match(path.begin(), path.end(), match, regex);
+    }
+
+    // A route pattern such as "/items/{id}", matched segment by segment. This
+    // gives the same result as the compiled regex and does not allocate, but
+    // only applies when each parameter fills a whole segment and the literal
+    // text has no regex syntax; compile() returns nullopt otherwise.
+    class PathSegments {
+    public:
+        static std::optional<PathSegments> compile(std::string_view pattern) {
+            PathSegments result;
+            while (true) {
+                auto slash = pattern.find('/');
+                std::string_view segment = pattern.substr(0, slash);
+                if (segment.size() > 2 && segment.front() == '{' && segment.back() == '}' &&
+                    segment.find_first_of("{}", 1) == segment.size() - 1) {
+                    result.segments.push_back({"", true});
+                } else if (segment.find_first_of(".[]{}()*+?^$|\\") == std::string_view::npos) {
+                    result.segments.push_back({std::string(segment), false});
+                } else {
+                    return std::nullopt;
+                }
+                if (slash == std::string_view::npos) return result;
+                pattern.remove_prefix(slash + 1);
+            }
+        }
+
+        bool match(std::string_view path) const {
+            return match(path, [](size_t, std::string_view) {});
+        }
+
+        // Also calls on_param(index, value) for each parameter, index counting
+        // parameters in pattern order. On a mismatch, parameters before it may
+        // already have been reported.
+        template<typename OnParam>
+        bool match(std::string_view path, OnParam&& on_param) const {
+            size_t param = 0;
+            for (size_t i = 0; i < segments.size(); ++i) {
+                auto slash = path.find('/');
+                if ((slash == std::string_view::npos) != (i + 1 == segments.size())) return false;
+                std::string_view segment = path.substr(0, slash);
+                if (segments[i].param) {
+                    if (segment.empty()) return false;
+                    on_param(param++, segment);
+                } else if (segment != segments[i].literal) {
+                    return false;
+                }
+                path.remove_prefix(slash == std::string_view::npos ? path.size() : slash + 1);
+            }
+            return true;
+        }
+
+    private:
+        struct Segment {
+            std::string literal;
+            bool param;
+        };
+        std::vector<Segment> segments;
+    };
+
+    // Turns "/items/{id}" into an anchored regex with one capture group per
+    // parameter, appending the parameter names to param_names.
+    inline std::string compile_path_pattern(const std::string& path_pattern, std::vector<std::string>& param_names) {
+        std::string pattern = "^";
+        std::regex param_regex(R"(\{([^}]+)\})");
+        std::string::const_iterator search_start(path_pattern.cbegin());
+        std::smatch match;
+
+        while (std::regex_search(search_start, path_pattern.cend(), match, param_regex)) {
+            pattern += std::string(search_start, match.prefix().second);
+            pattern += "([^/]+)";
+            param_names.push_back(match[1]);
+            search_start = match.suffix().first;
+        }
+
+        pattern += std::string(search_start, path_pattern.cend());
+        pattern += "(?:\\?.*)?$";
+        return pattern;
+    }
 
     class Route {
     public:
-        virtual Response handle(const Request& request, const std::map<std::string, std::string>& params) const = 0;
-        virtual bool matches(const Method& method, const std::string& uri) const = 0;
-        virtual std::map<std::string, std::string> extract_params(const std::string& uri) const = 0;
+        virtual Response handle(const Request& request, Params params) const = 0;
+        virtual bool matches(const Method& method, std::string_view uri, std::pmr::memory_resource* resource) const = 0;
+        virtual Params extract_params(std::string_view uri, std::pmr::memory_resource* resource) const = 0;
         virtual const std::string& get_path_pattern() const = 0;
         virtual const std::regex& get_regex() const = 0;
         virtual const std::vector<std::string>& get_param_names() const = 0;
         virtual Method get_method() const = 0;
+        virtual bool streams_body() const { return false; }
+        virtual BodyStream open_stream(const Request&, Params) const {
+            throw std::logic_error("Route does not stream request bodies");
+        }
+        // Complete HTTP/1.1 response bytes for routes whose response never
+        // changes, or nullptr if the response must be built per request. Without
+        // keep_alive the bytes include "Connection: close".
+        virtual const std::string* wire_response(const Request&, bool) const { return nullptr; }
+        // Produces the response through respond, possibly after returning.
+        virtual void handle_async(const Request& request, Params params, const Responder& respond) const {
+            respond(handle(request, std::move(params)));
+        }
         virtual ~Route() = default;
     };
 
@@ -41,61 +184,81 @@ namespace fastapi_cpp {
         Method method;
         std::string path_pattern;
         std::regex path_regex;
+        std::optional<PathSegments> segments;
         std::vector<std::string> param_names;
         Func handler;
 
     public:
         FunctionRoute(Method m, std::string p, Func h)
                 : method(m), path_pattern(std::move(p)), handler(std::move(h)) {
-            std::string pattern = "^";
-            std::regex param_regex(R"(\{([^}]+)\})");
-            std::string::const_iterator search_start(path_pattern.cbegin());
-            std::smatch match;
-
-            while (std::regex_search(search_start, path_pattern.cend(), match, param_regex)) {
-                pattern += std::string(search_start, match.prefix().second);
-                pattern += "([^/]+)";
-                param_names.push_back(match[1]);
-                search_start = match.suffix().first;
-            }
-
-            pattern += std::string(search_start, path_pattern.cend());
-            pattern += "(?:\\?.*)?$";
-
+            std::string pattern = compile_path_pattern(path_pattern, param_names);
             path_regex = std::regex(pattern);
+            segments = PathSegments::compile(path_pattern);
             std::cout << "Route created: " << method_to_string(method) << " " << path_pattern << std::endl;
             std::cout << "Regex pattern: " << pattern << std::endl;
         }
 
-        bool matches(const Method& m, const std::string& uri) const override {
+        bool matches(const Method& m, std::string_view uri, std::pmr::memory_resource* resource) const override {
             if (method != m) return false;
 
-            auto query_pos = uri.find('?');
-            std::string path = (query_pos != std::string::npos) ? uri.substr(0, query_pos) : uri;
-
-            return std::regex_match(path, path_regex);
+            std::string_view path = uri.substr(0, uri.find('?'));
+            if (segments) return segments->match(path);
+            PathMatch match(resource);
+            return match_path(path, path_regex, match);
         }
 
 
-        std::map<std::string, std::string> extract_params(const std::string& uri) const override {
-            std::map<std::string, std::string> params;
-            std::smatch match;
-            std::string uri_without_query = uri.substr(0, uri.find('?'));
-            if (std::regex_match(uri_without_query, match, path_regex)) {
+        Params extract_params(std::string_view uri, std::pmr::memory_resource* resource) const override {
+            Params params(resource);
+            std::string_view path = uri.substr(0, uri.find('?'));
+            if (segments) {
+                segments->match(path, [&](size_t i, std::string_view value) { params.emplace(param_names[i], value); });
+                return params;
+            }
+            PathMatch match(resource);
+            if (match_path(path, path_regex, match)) {
                 for (size_t i = 0; i < param_names.size(); i++) {
-                    params[param_names[i]] = match[i + 1].str();
+                    params.emplace(param_names[i], std::string_view(match[i + 1].first, match[i + 1].second));
                 }
             }
             return params;
         }
 
-        Response handle(const Request& request, const std::map<std::string, std::string>& params) const override {
-            auto query_params = parse_query_string(request.uri);
+        Response handle(const Request& request, Params params) const override {
+            add_query_params(request, params);
+
+            if constexpr (std::is_same_v<Func, StreamHandler>) {
+                // Already-buffered body (e.g. HTTP/2): deliver it as a single chunk.
+                BodyStream stream = handler(request, params);
+                if (!request.body.empty()) stream.on_data(request.body);
+                return stream.on_complete();
+            } else if constexpr (std::is_same_v<Func, AsyncHandler>) {
+                throw std::logic_error("Asynchronous route must be called through handle_async");
+            } else {
+                return handler(request, params);
+            }
+        }
+
+        void handle_async(const Request& request, Params params, const Responder& respond) const override {
+            if constexpr (std::is_same_v<Func, AsyncHandler>) {
+                add_query_params(request, params);
+                handler(request, params, respond);
+            } else {
+                Route::handle_async(request, std::move(params), respond);
+            }
+        }
 
-            auto all_params = params;
-            all_params.insert(query_params.begin(), query_params.end());
+        bool streams_body() const override {
+            return std::is_same_v<Func, StreamHandler>;
+        }
 
-            return handler(request, all_params);
+        BodyStream open_stream(const Request& request, Params params) const override {
+            if constexpr (std::is_same_v<Func, StreamHandler>) {
+                add_query_params(request, params);
+                return handler(request, params);
+            } else {
+                return Route::open_stream(request, std::move(params));
+            }
         }
 
         const std::string& get_path_pattern() const override {
@@ -113,37 +276,319 @@ namespace fastapi_cpp {
         Method get_method() const override {
             return method;
         }
-    private:
-        std::map<std::string, std::string> parse_query_string(const std::string& uri) const {
-            std::map<std::string, std::string> query_params;
-            auto query_pos = uri.find('?');
-            if (query_pos != std::string::npos) {
-                std::string query = uri.substr(query_pos + 1);
-                std::istringstream iss(query);
-                std::string pair;
-                while (std::getline(iss, pair, '&')) {
-                    auto eq_pos = pair.find('=');
-                    if (eq_pos != std::string::npos) {
-                        std::string key = pair.substr(0, eq_pos);
-                        std::string value = pair.substr(eq_pos + 1);
-                        query_params[key] = value;
-                    }
-                }
+    };
+
+    // Route that always returns the same response. The HTTP/1.1 wire bytes
+    // (status line, headers, Content-Length and body) are serialized once when
+    // the route is registered; variants for compressible responses (with Vary,
+    // compressed or not) are built on first use and kept, so hot endpoints are
+    // never recompressed.
+    class StaticRoute : public Route {
+        struct Variant {
+            Response response;
+            std::string wire;
+            // The same response with "Connection: close", for connections that
+            // close after it.
+            std::string wire_close;
+        };
+
+        Method method;
+        std::string path_pattern;
+        std::regex path_regex;
+        std::optional<PathSegments> segments;
+        std::vector<std::string> param_names;
+        const http::CompressionConfig& compression;
+        // The response as registered, sent while it is not compressible.
+        std::unique_ptr<Variant> plain;
+        // Indexed by http::ContentCoding.
+        mutable std::unique_ptr<Variant> variants[3];
+
+        static std::unique_ptr<Variant> make_variant(Response response) {
+            if (http::find_header(response.headers, "Content-Length") == response.headers.end()) {
+                response.headers["Content-Length"] = std::to_string(response.body.size());
             }
-            return query_params;
+            std::string wire(http::construct_response(response));
+            Response closing = response;
+            closing.headers["Connection"] = "close";
+            std::string wire_close(http::construct_response(closing));
+            return std::make_unique<Variant>(Variant{std::move(response), std::move(wire), std::move(wire_close)});
+        }
+
+        const Variant& variant_for(const Request& request) const {
+            // Checked per request: compression may be enabled after registration.
+            if (!http::should_compress(plain->response, compression)) return *plain;
+            auto coding = http::negotiate_encoding(request.get_header("Accept-Encoding"));
+            auto& variant = variants[static_cast<int>(coding)];
+            if (!variant) {
+                Response encoded = plain->response;
+                http::add_vary_accept_encoding(encoded);
+                http::encode_response(encoded, coding, compression.level);
+                variant = make_variant(std::move(encoded));
+            }
+            return *variant;
+        }
+
+    public:
+        StaticRoute(Method m, std::string p, Response r, const http::CompressionConfig& compression)
+                : method(m), path_pattern(std::move(p)), compression(compression) {
+            path_regex = std::regex(compile_path_pattern(path_pattern, param_names));
+            segments = PathSegments::compile(path_pattern);
+            plain = make_variant(std::move(r));
+            std::cout << "Static route created: " << method_to_string(method) << " " << path_pattern << std::endl;
+        }
+
+        bool matches(const Method& m, std::string_view uri, std::pmr::memory_resource* resource) const override {
+            if (method != m) return false;
+
+            std::string_view path = uri.substr(0, uri.find('?'));
+            if (segments) return segments->match(path);
+            PathMatch match(resource);
+            return match_path(path, path_regex, match);
+        }
+
+        Params extract_params(std::string_view, std::pmr::memory_resource* resource) const override {
+            return Params(resource);
+        }
+
+        Response handle(const Request& request, Params) const override {
+            return variant_for(request).response;
+        }
+
+        const std::string* wire_response(const Request& request, bool keep_alive) const override {
+            const Variant& variant = variant_for(request);
+            return keep_alive ? &variant.wire : &variant.wire_close;
+        }
+
+        const std::string& get_path_pattern() const override {
+            return path_pattern;
+        }
+
+        const std::regex& get_regex() const override {
+            return path_regex;
+        }
+
+        const std::vector<std::string>& get_param_names() const override {
+            return param_names;
+        }
+
+        Method get_method() const override {
+            return method;
         }
     };
 
+    struct ServerConfig {
+        // IPv4 or IPv6 literal to bind; "::" accepts both families.
+        std::string host = "0.0.0.0";
+        int port = 8000;
+        // When set, listen on this AF_UNIX path instead of TCP.
+        std::string unix_path;
+        int backlog = SOMAXCONN;
+        bool reuse_address = true;
+        bool reuse_port = false;
+        bool tcp_nodelay = true;
+        // Seconds to wait for request data before waking accept (TCP_DEFER_ACCEPT); 0 disables.
+        int defer_accept_seconds = 0;
+        // Pending TCP Fast Open queue length (TCP_FASTOPEN); 0 disables.
+        int fast_open_queue = 0;
+        // SO_SNDBUF / SO_RCVBUF in bytes; 0 keeps the system default.
+        int send_buffer_size = 0;
+        int receive_buffer_size = 0;
+        // AF_UNIX path over which a newly started process takes over the
+        // listening socket (zero-downtime upgrade); empty disables handoff.
+        std::string handoff_path;
+        // How long in-flight requests may take to finish once draining starts.
+        int drain_timeout_ms = 30000;
+        // Idle HTTP/1.1 keep-alive connections are closed after this long.
+        int keep_alive_timeout_ms = 5000;
+        // A request's head and buffered body must arrive within this long, and a
+        // streamed body may not stall for longer; otherwise the client gets 408.
+        int request_timeout_ms = 30000;
+        // An asynchronous handler that has not responded after this long is
+        // answered with 504 on its behalf.
+        int response_timeout_ms = 30000;
+    };
+
+    // Creates a bound, listening, non-blocking socket for config.
+    inline int create_listener(const ServerConfig& config) {
+        sockaddr_storage address{};
+        socklen_t address_length;
+        int family;
+
+        if (!config.unix_path.empty()) {
+            auto* un = reinterpret_cast<sockaddr_un*>(&address);
+            if (config.unix_path.size() >= sizeof(un->sun_path)) {
+                throw std::runtime_error("Unix socket path too long");
+            }
+            family = AF_UNIX;
+            un->sun_family = AF_UNIX;
+            std::memcpy(un->sun_path, config.unix_path.c_str(), config.unix_path.size() + 1);
+            address_length = sizeof(sockaddr_un);
+            // A socket file left behind by a previous run would make bind fail.
+            unlink(config.unix_path.c_str());
+        } else if (config.host.find(':') != std::string::npos) {
+            auto* in6 = reinterpret_cast<sockaddr_in6*>(&address);
+            family = AF_INET6;
+            in6->sin6_family = AF_INET6;
+            in6->sin6_port = htons(config.port);
+            if (inet_pton(AF_INET6, config.host.c_str(), &in6->sin6_addr) != 1) {
+                throw std::runtime_error("Invalid IPv6 address: " + config.host);
+            }
+            address_length = sizeof(sockaddr_in6);
+        } else {
+            auto* in = reinterpret_cast<sockaddr_in*>(&address);
+            family = AF_INET;
+            in->sin_family = AF_INET;
+            in->sin_port = htons(config.port);
+            if (inet_pton(AF_INET, config.host.c_str(), &in->sin_addr) != 1) {
+                throw std::runtime_error("Invalid IPv4 address: " + config.host);
+            }
+            address_length = sizeof(sockaddr_in);
+        }
+
+        int fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            throw std::runtime_error("Socket creation failed");
+        }
+
+        auto set_option = [fd](int level, int name, int value, const char* what) {
+            if (setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+                std::cerr << "Failed to set " << what << ": " << std::strerror(errno) << std::endl;
+            }
+        };
+
+        if (family != AF_UNIX) {
+            if (config.reuse_address) set_option(SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR");
+            if (config.reuse_port) set_option(SOL_SOCKET, SO_REUSEPORT, 1, "SO_REUSEPORT");
+            if (family == AF_INET6) set_option(IPPROTO_IPV6, IPV6_V6ONLY, 0, "IPV6_V6ONLY");
+            if (config.tcp_nodelay) set_option(IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+            if (config.defer_accept_seconds > 0) {
+                set_option(IPPROTO_TCP, TCP_DEFER_ACCEPT, config.defer_accept_seconds, "TCP_DEFER_ACCEPT");
+            }
+            if (config.fast_open_queue > 0) {
+                set_option(IPPROTO_TCP, TCP_FASTOPEN, config.fast_open_queue, "TCP_FASTOPEN");
+            }
+        }
+        if (config.send_buffer_size > 0) set_option(SOL_SOCKET, SO_SNDBUF, config.send_buffer_size, "SO_SNDBUF");
+        if (config.receive_buffer_size > 0) set_option(SOL_SOCKET, SO_RCVBUF, config.receive_buffer_size, "SO_RCVBUF");
+
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), address_length) < 0) {
+            close(fd);
+            throw std::runtime_error(std::string("Bind failed: ") + std::strerror(errno));
+        }
+
+        if (listen(fd, config.backlog) < 0) {
+            close(fd);
+            throw std::runtime_error("Listen failed");
+        }
+        return fd;
+    }
+
+    // Passes fd to the process at the other end of a Unix socket (SCM_RIGHTS).
+    inline bool send_fd(int socket_fd, int fd) {
+        char byte = 'L';
+        iovec iov{&byte, 1};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+        msghdr message{};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(header), &fd, sizeof(int));
+
+        ssize_t sent;
+        do {
+            sent = sendmsg(socket_fd, &message, MSG_NOSIGNAL);
+        } while (sent < 0 && errno == EINTR);
+        return sent == 1;
+    }
+
+    // Receives a file descriptor sent with send_fd, or returns -1.
+    inline int receive_fd(int socket_fd) {
+        char byte;
+        iovec iov{&byte, 1};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+        msghdr message{};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        ssize_t received;
+        do {
+            received = recvmsg(socket_fd, &message, MSG_CMSG_CLOEXEC);
+        } while (received < 0 && errno == EINTR);
+        if (received != 1) return -1;
+
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+        if (!header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS ||
+            header->cmsg_len != CMSG_LEN(sizeof(int))) {
+            return -1;
+        }
+        int fd;
+        std::memcpy(&fd, CMSG_DATA(header), sizeof(int));
+        return fd;
+    }
+
+    inline sockaddr_un handoff_address(const std::string& path) {
+        sockaddr_un address{};
+        if (path.size() >= sizeof(address.sun_path)) {
+            throw std::runtime_error("Handoff socket path too long");
+        }
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+        return address;
+    }
+
+    // Asks a server already running with the same handoff_path for its listening
+    // socket. Returns -1 if there is no such server.
+    inline int take_over_listener(const std::string& handoff_path) {
+        sockaddr_un address = handoff_address(handoff_path);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+            close(fd);
+            return -1;
+        }
+        timeval timeout{5, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        int listener = receive_fd(fd);
+        close(fd);
+        return listener;
+    }
+
+    // Listens on handoff_path for a newer process asking for the listener.
+    inline int create_handoff_socket(const std::string& handoff_path) {
+        sockaddr_un address = handoff_address(handoff_path);
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            throw std::runtime_error("Handoff socket creation failed");
+        }
+        unlink(handoff_path.c_str());
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(fd, 1) < 0) {
+            close(fd);
+            throw std::runtime_error(std::string("Handoff socket bind failed: ") + std::strerror(errno));
+        }
+        return fd;
+    }
+
     class FastAPI {
     public:
         FastAPI() {
             running = false;
-            //server_fd = -1;
-            //instance = this;
+            server_fd = -1;
+            instance = this;
         }
 
         ~FastAPI() {
             stop();
+            if (instance == this) {
+                instance = nullptr;
+            }
         }
 
         template<typename Func>
@@ -151,157 +596,1005 @@ namespace fastapi_cpp {
             routes.push_back(std::make_unique<FunctionRoute<Func>>(method, path, std::move(handler)));
         }
 
-        void get(const std::string& path, std::function<Response(const Request&, const std::map<std::string, std::string>&)> handler) {
+        void get(const std::string& path, Handler handler) {
             add_route(Method::GET, path, std::move(handler));
         }
 
-        void post(const std::string& path, std::function<Response(const Request&, const std::map<std::string, std::string>&)> handler) {
+        void post(const std::string& path, Handler handler) {
             add_route(Method::POST, path, std::move(handler));
         }
 
-        void put(const std::string& path, std::function<Response(const Request&, const std::map<std::string, std::string>&)> handler) {
+        void put(const std::string& path, Handler handler) {
             add_route(Method::PUT, path, std::move(handler));
         }
 
-        void patch(const std::string& path, std::function<Response(const Request&, const std::map<std::string, std::string>&)> handler) {
+        void patch(const std::string& path, Handler handler) {
             add_route(Method::PATCH, path, std::move(handler));
         }
 
-        void delete_(const std::string& path, std::function<Response(const Request&, const std::map<std::string, std::string>&)> handler) {
+        void delete_(const std::string& path, Handler handler) {
             add_route(Method::DELETE, path, std::move(handler));
         }
 
-        Response handle_request(const Request& req) {
-            std::cout << "Handling request: " << method_to_string(req.method) << " " << req.uri << std::endl;
+        // GET route with a constant response, e.g. a health check. The response
+        // is serialized once here and each hit is sent without running a handler.
+        void get_static(const std::string& path, Response response) {
+            routes.push_back(std::make_unique<StaticRoute>(Method::GET, path, std::move(response), compression));
+        }
 
+        // Compresses responses of at least min_size bytes with a compressible
+        // Content-Type using gzip or deflate, as negotiated via Accept-Encoding.
+        void enable_compression(size_t min_size = 1024, int level = Z_DEFAULT_COMPRESSION) {
+            compression.enabled = true;
+            compression.min_size = min_size;
+            compression.level = level;
+        }
+
+        // POST route whose body is handed to the handler's BodyStream as it is
+        // received over HTTP/1.1, so uploads are never buffered whole.
+        void post_stream(const std::string& path, StreamHandler handler) {
+            add_route(Method::POST, path, std::move(handler));
+        }
+
+        void put_stream(const std::string& path, StreamHandler handler) {
+            add_route(Method::PUT, path, std::move(handler));
+        }
+
+        // Routes whose handler responds later through a Responder, so it can wait
+        // on upstream calls without blocking the event loop.
+        void get_async(const std::string& path, AsyncHandler handler) {
+            add_route(Method::GET, path, std::move(handler));
+        }
+
+        void post_async(const std::string& path, AsyncHandler handler) {
+            add_route(Method::POST, path, std::move(handler));
+        }
+
+        // The loop run() serves on; pass it to http::Client for upstream calls.
+        http::EventLoop& event_loop() {
+            return events;
+        }
+
+        // Registers a WebSocket endpoint. GET requests to path that ask for an
+        // RFC 6455 upgrade are switched over; other requests fall through to the
+        // HTTP routes.
+        void websocket(const std::string& path, http::ws::Handler handler) {
+            std::vector<std::string> param_names;
+            websocket_routes.push_back({std::regex(compile_path_pattern(path, param_names)),
+                                        std::make_shared<const http::ws::Handler>(std::move(handler))});
+            std::cout << "WebSocket route created: " << path << std::endl;
+        }
+
+        void websocket(const std::string& path, std::function<void(http::ws::WebSocket&, const http::ws::Message&)> on_message) {
+            websocket(path, http::ws::Handler{nullptr, std::move(on_message), nullptr});
+        }
+
+        // The first route registered for req's method and path. HEAD falls back
+        // to the GET route of the same path when no route handles HEAD.
+        const Route* find_route(const Request& req) const {
             for (const auto& route : routes) {
-                try {
-                    std::cout << "Checking route: " << method_to_string(route->get_method()) << " " << route->get_path_pattern() << std::endl;
+                if (route->matches(req.method, req.uri, req.resource())) return route.get();
+            }
+            if (req.method == Method::HEAD) {
+                for (const auto& route : routes) {
+                    if (route->matches(Method::GET, req.uri, req.resource())) return route.get();
+                }
+            }
+            return nullptr;
+        }
 
-                    if (route->matches(req.method, req.uri)) {
-                        std::cout << "Route matched!" << std::endl;
-                        auto params = route->extract_params(req.uri);
+        // Routes req and hands the response to done, which asynchronous routes
+        // call after this returns.
+        void route_request(const Request& req, const Responder& done) {
+            std::cout << "Handling request: " << method_to_string(req.method) << " " << req.uri << std::endl;
 
-                        for (const auto& [key, value] : params) {
-                            std::cout << "Param: " << key << " = " << value << std::endl;
-                        }
+            http::trace::Span routing(http::trace::Phase::ROUTE);
+            try {
+                if (const Route* route = find_route(req)) {
+                    std::cout << "Route matched: " << method_to_string(route->get_method()) << " " << route->get_path_pattern() << std::endl;
+                    auto params = route->extract_params(req.uri, req.resource());
 
-                        return route->handle(req, params);
-                    } else {
-                        std::cout << "Route did not match" << std::endl;
+                    for (const auto& [key, value] : params) {
+                        std::cout << "Param: " << key << " = " << value << std::endl;
                     }
-                } catch (const std::exception& e) {
-                    std::cerr << "Error in route handling: " << e.what() << std::endl;
+
+                    routing.end();
+                    http::trace::Span handling(http::trace::Phase::HANDLER);
+                    route->handle_async(req, std::move(params), done);
+                    return;
                 }
+            } catch (const std::exception& e) {
+                std::cerr << "Error in route handling: " << e.what() << std::endl;
             }
 
             std::cout << "No matching route found, returning 404" << std::endl;
-            return http::HTTP_404_NOT_FOUND();
+            done(http::HTTP_404_NOT_FOUND());
         }
 
-        void run(int port) {
-            int server_fd;
-            struct sockaddr_in address;
-            int addrlen = sizeof(address);
-            char buffer[4096] = {0};
+        Response handle_request(const Request& req) {
+            std::optional<Response> result;
+            route_request(req, [&result](Response response) { result = std::move(response); });
+            if (!result) {
+                return http::HTTP_500_INTERNAL_SERVER_ERROR(http::JSON::object({{"error", "Route did not respond synchronously"}}));
+            }
+            return std::move(*result);
+        }
 
-            if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
-                throw std::runtime_error("Socket creation failed");
+        // route_request plus response compression.
+        void serve(const Request& req, Responder done) {
+            if (!compression.enabled) {
+                route_request(req, done);
+                return;
             }
+            route_request(req, [this, accept_encoding = req.get_header("Accept-Encoding"), done = std::move(done),
+                                trace_id = http::trace::current_request](Response response) {
+                http::trace::Scope tracing(trace_id);
+                http::trace::Span compressing(http::trace::Phase::COMPRESS);
+                http::compress_response(response, accept_encoding, compression);
+                done(std::move(response));
+            });
+        }
 
-            address.sin_family = AF_INET;
-            address.sin_addr.s_addr = INADDR_ANY;
-            address.sin_port = htons(port);
+        // Samples one in every sample_every requests into per-thread trace
+        // buffers. The buffered trace (Chrome trace-event JSON) is written to
+        // trace-<pid>.json when dump_signal arrives. If path is given it is also
+        // served at GET path; that route has no authentication, so only set it
+        // where the port is not reachable by untrusted clients.
+        void enable_tracing(uint32_t sample_every = 1, int dump_signal = SIGUSR2, const std::string& path = "") {
+            http::trace::enable(sample_every);
+            if (!path.empty()) {
+                get(path, [](const Request&, const Params&) {
+                    return Response{{1, 1}, http::HttpStatus::OK, {{"Content-Type", "application/json"}},
+                                    http::trace::chrome_trace_json()};
+                });
+            }
+            std::signal(dump_signal, http::trace::request_dump);
+        }
 
-            if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
-                close(server_fd);
-                throw std::runtime_error("Bind failed");
+        void run(int port) {
+            ServerConfig config;
+            config.port = port;
+            run(config);
+        }
+
+        void run(const ServerConfig& config) {
+            server_fd = -1;
+            if (!config.handoff_path.empty()) {
+                server_fd = take_over_listener(config.handoff_path);
+                if (server_fd >= 0) {
+                    std::cout << "Took over listening socket from previous process" << std::endl;
+                }
             }
+            if (server_fd < 0) {
+                server_fd = create_listener(config);
+            }
+            unix_path = config.unix_path;
+            handoff_path = config.handoff_path;
+            drain_timeout = std::chrono::milliseconds(config.drain_timeout_ms);
+            keep_alive_timeout = std::chrono::milliseconds(config.keep_alive_timeout_ms);
+            request_timeout = std::chrono::milliseconds(config.request_timeout_ms);
+            response_timeout = std::chrono::milliseconds(config.response_timeout_ms);
+            tcp_nodelay = config.tcp_nodelay && config.unix_path.empty();
+            listener_handed_off = false;
+            draining = false;
+            drain_requested = false;
 
-            if (listen(server_fd, 3) < 0) {
-                close(server_fd);
-                throw std::runtime_error("Listen failed");
+            if (config.unix_path.empty()) {
+                std::cout << "Server listening on " << config.host << " port " << config.port << std::endl;
+            } else {
+                std::cout << "Server listening on " << config.unix_path << std::endl;
             }
 
-            std::cout << "Server listening on port " << port << std::endl;
+            std::signal(SIGINT, signal_handler);
+            std::signal(SIGTERM, signal_handler);
 
-            //std::signal(SIGINT, signal_handler);
-            //std::signal(SIGTERM, signal_handler);
+            loop = &events;
+            events.add(server_fd, EPOLLIN, [this](uint32_t) { accept_connections(); });
+            if (!handoff_path.empty()) {
+                handoff_fd = create_handoff_socket(handoff_path);
+                events.add(handoff_fd, EPOLLIN, [this](uint32_t) { hand_off_listener(); });
+            }
 
             running = true;
+            auto last_sweep = std::chrono::steady_clock::now();
 
             while (running) {
-                fd_set readfds;
-                FD_ZERO(&readfds);
-                FD_SET(server_fd, &readfds);
+                events.run_once(draining ? 100 : 1000);
+                auto now = std::chrono::steady_clock::now();
+                if (now - last_sweep >= std::chrono::seconds(1)) {
+                    close_expired_connections(now);
+                    last_sweep = now;
+                }
+                if (http::trace::dump_requested) {
+                    http::trace::dump_requested = 0;
+                    dump_trace();
+                }
+                if (drain_requested && !draining) {
+                    begin_drain();
+                }
+                if (draining) {
+                    close_idle_connections();
+                    if (connections.empty()) break;
+                    if (std::chrono::steady_clock::now() >= drain_deadline) {
+                        std::cout << "Drain deadline reached, closing " << connections.size() << " connections" << std::endl;
+                        break;
+                    }
+                }
+            }
 
-                struct timeval timeout;
-                timeout.tv_sec = 1;
-                timeout.tv_usec = 0;
+            while (!connections.empty()) {
+                close_connection(connections.begin()->first);
+            }
+            close_listeners();
+            loop = nullptr;
+            if (!unix_path.empty() && !listener_handed_off) {
+                unlink(unix_path.c_str());
+            }
 
-                int activity = select(server_fd + 1, &readfds, NULL, NULL, &timeout);
+            std::cout << "Server stopped" << std::endl;
+        }
 
-                if (activity < 0 && errno != EINTR) {
-                    std::cerr << "Select error" << std::endl;
-                    continue;
+        // Stops accepting and lets in-flight requests finish (up to the
+        // configured drain timeout) before run() returns. SIGTERM and SIGINT
+        // do the same; a second signal stops immediately.
+        void drain() {
+            drain_requested = true;
+        }
+
+        void stop() {
+            running = false;
+            // Unregisters the listeners before closing them, so no handler is
+            // left on an fd number the kernel may hand out again.
+            close_listeners();
+        }
+
+    private:
+        // One accepted socket. HTTP/1.1 requests are buffered until complete; a
+        // connection switches to HTTP/2 on the client preface or "Upgrade: h2c".
+        struct Connection {
+            int fd;
+            // Distinguishes this connection from a later one that reuses the fd.
+            uint64_t id = 0;
+            std::string in;
+            std::string out;
+            size_t out_offset = 0;
+            // Backs the request being handled; taken from the server's pool
+            // and returned once the request is done. Declared before h2, whose
+            // session allocates from it, so it outlives the session.
+            std::unique_ptr<http::Arena> arena;
+            std::unique_ptr<http::h2::Session> h2;
+            std::shared_ptr<http::ws::WebSocket> ws;
+            // Closes a WebSocket whose peer does not answer our close frame.
+            http::EventLoop::TimerId close_timer = 0;
+            std::unique_ptr<BodyStream> upload;
+            size_t upload_remaining = 0;
+            // Size of the buffered request once its head has been parsed.
+            size_t pending_request_size = 0;
+            bool close_after_write = false;
+            // An HTTP/1.1 request is waiting for an asynchronous response;
+            // pipelined requests behind it are not processed until it is sent.
+            bool awaiting_response = false;
+            std::chrono::steady_clock::time_point accepted_at = std::chrono::steady_clock::now();
+            std::chrono::steady_clock::time_point last_active = accepted_at;
+            // When the first byte of the request being received arrived.
+            std::chrono::steady_clock::time_point request_started = accepted_at;
+            // When the handler of the request in awaiting_response was called.
+            std::chrono::steady_clock::time_point response_started;
+            // Trace of the HTTP/1.1 request being received or streamed in.
+            http::trace::RequestTrace request_trace;
+            // Trace of the last response queued; ended once it has been sent.
+            http::trace::RequestTrace sending_trace;
+        };
+
+        struct WebSocketRoute {
+            std::regex path_regex;
+            std::shared_ptr<const http::ws::Handler> handler;
+        };
+
+        static constexpr size_t max_header_size = 64 * 1024;
+        static constexpr size_t max_body_size = 16 * 1024 * 1024;
+        // While draining, a connection that has sent nothing yet is kept this
+        // long after accept so a request already on the wire is not reset.
+        static constexpr std::chrono::milliseconds drain_accept_grace{500};
+        // How long a WebSocket peer has to answer our close frame.
+        static constexpr std::chrono::milliseconds websocket_close_timeout{5000};
+        // Idle arenas kept for reuse; beyond this they are freed.
+        static constexpr size_t max_spare_arenas = 64;
+
+        std::vector<std::unique_ptr<Route>> routes;
+        std::atomic<bool> running;
+        int server_fd;
+        std::string unix_path;
+        bool tcp_nodelay = false;
+        std::vector<WebSocketRoute> websocket_routes;
+        http::EventLoop events;
+        http::EventLoop* loop = nullptr;
+        uint64_t next_connection_id = 0;
+        std::chrono::milliseconds keep_alive_timeout{5000};
+        std::chrono::milliseconds request_timeout{30000};
+        std::chrono::milliseconds response_timeout{30000};
+        http::CompressionConfig compression;
+        std::string handoff_path;
+        int handoff_fd = -1;
+        bool listener_handed_off = false;
+        std::atomic<bool> drain_requested{false};
+        bool draining = false;
+        std::chrono::milliseconds drain_timeout{30000};
+        std::chrono::steady_clock::time_point drain_deadline;
+        std::unordered_map<int, std::unique_ptr<Connection>> connections;
+        int current_fd = -1;
+        std::vector<std::unique_ptr<http::Arena>> spare_arenas;
+        static inline FastAPI* instance = nullptr;
+
+        void accept_connections() {
+            while (true) {
+                int fd = accept4(server_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                        std::cerr << "Accept failed" << std::endl;
+                    }
+                    return;
                 }
 
-                if (!running) break;
+                if (tcp_nodelay) {
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                }
 
-                if (activity == 0) continue;
+                auto connection = std::make_unique<Connection>();
+                connection->fd = fd;
+                connection->id = ++next_connection_id;
+                connections[fd] = std::move(connection);
+                loop->add(fd, EPOLLIN, [this, fd](uint32_t events) { on_connection_event(fd, events); });
+            }
+        }
 
-                int new_socket;
-                if ((new_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t*)&addrlen)) < 0) {
-                    std::cerr << "Accept failed" << std::endl;
-                    continue;
+        void close_connection(int fd) {
+            auto it = connections.find(fd);
+            if (it == connections.end()) return;
+            if (loop) {
+                loop->remove(fd);
+                if (it->second->close_timer) loop->cancel(it->second->close_timer);
+            }
+            close(fd);
+            auto ws = std::move(it->second->ws);
+            // Kept alive until the HTTP/2 session that draws from it is gone.
+            auto arena = std::move(it->second->arena);
+            connections.erase(it);
+            if (ws) ws->detach();
+            recycle_arena(std::move(arena));
+        }
+
+        // The arena for conn's current request, taken from the pool on first use.
+        http::Arena& request_arena(Connection& conn) {
+            if (!conn.arena) {
+                if (spare_arenas.empty()) {
+                    conn.arena = std::make_unique<http::Arena>();
+                } else {
+                    conn.arena = std::move(spare_arenas.back());
+                    spare_arenas.pop_back();
                 }
+            }
+            return *conn.arena;
+        }
+
+        // Frees everything the finished request drew from conn's arena. Outside
+        // HTTP/2, whose session holds on to it, the arena goes back to the pool.
+        void release_arena(Connection& conn) {
+            if (!conn.arena) return;
+            if (conn.h2) {
+                conn.arena->reset();
+                return;
+            }
+            recycle_arena(std::move(conn.arena));
+        }
+
+        void recycle_arena(std::unique_ptr<http::Arena> arena) {
+            if (!arena) return;
+            arena->reset();
+            if (spare_arenas.size() < max_spare_arenas) {
+                spare_arenas.push_back(std::move(arena));
+            }
+        }
 
-                int valread = read(new_socket, buffer, 4096);
-                if (valread < 0) {
+        void on_connection_event(int fd, uint32_t events) {
+            auto it = connections.find(fd);
+            if (it == connections.end()) return;
+            Connection& conn = *it->second;
+            current_fd = fd;
+            conn.last_active = std::chrono::steady_clock::now();
+
+            // EPOLLHUP is reported even without read interest; a peer that hung
+            // up while its response is pending cannot receive it.
+            if ((events & EPOLLERR) || ((events & EPOLLHUP) && conn.awaiting_response)) {
+                current_fd = -1;
+                close_connection(fd);
+                return;
+            }
+
+            if ((events & (EPOLLIN | EPOLLHUP)) && !conn.awaiting_response) {
+                char buffer[16384];
+                while (true) {
+                    ssize_t valread = read(fd, buffer, sizeof(buffer));
+                    if (valread > 0) {
+                        if (conn.in.empty()) conn.request_started = conn.last_active;
+                        conn.in.append(buffer, valread);
+                        // Process per read so streamed uploads never pile up in memory.
+                        try {
+                            process_input(conn);
+                        } catch (const std::exception& e) {
+                            std::cerr << "Error handling request: " << e.what() << std::endl;
+                            conn.close_after_write = true;
+                        }
+                        // Pipelined requests stay in the socket while a response is pending.
+                        if (conn.close_after_write || conn.awaiting_response) break;
+                        continue;
+                    }
+                    if (valread == 0) {
+                        conn.close_after_write = true;
+                        break;
+                    }
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
                     std::cerr << "Read failed" << std::endl;
-                    close(new_socket);
-                    continue;
+                    current_fd = -1;
+                    close_connection(fd);
+                    return;
                 }
+            }
 
-                std::string request_str(buffer);
-                std::cout << "Received request:\n" << request_str << std::endl;
+            current_fd = -1;
+            if (flush(conn) && conn.ws) {
+                // Idle WebSockets should cost little more than their fd.
+                if (conn.in.capacity() > 4096 && conn.in.empty()) std::string().swap(conn.in);
+                if (conn.out.capacity() > 4096 && conn.out.empty()) std::string().swap(conn.out);
+            }
+        }
 
-                try {
-                    Request req = http::parse_request(request_str);
-                    Response resp = handle_request(req);
-                    std::string response_str = http::construct_response(resp);
+        // Writes as much pending output as the socket accepts. Returns false if the
+        // connection was closed.
+        bool flush(Connection& conn) {
+            http::trace::Scope tracing(conn.sending_trace.id);
+            http::trace::Span sending(http::trace::Phase::SEND);
+            while (conn.out_offset < conn.out.size()) {
+                ssize_t sent = send(conn.fd, conn.out.data() + conn.out_offset, conn.out.size() - conn.out_offset, MSG_NOSIGNAL);
+                if (sent < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        loop->modify(conn.fd, read_interest(conn) | EPOLLOUT);
+                        return true;
+                    }
+                    std::cerr << "Send failed" << std::endl;
+                    close_connection(conn.fd);
+                    return false;
+                }
+                conn.out_offset += sent;
+            }
+
+            conn.out.clear();
+            conn.out_offset = 0;
+            sending.end();
+            http::trace::end_request(conn.sending_trace);
+            if (conn.close_after_write) {
+                close_connection(conn.fd);
+                return false;
+            }
+            loop->modify(conn.fd, read_interest(conn));
+            return true;
+        }
 
-                    std::cout << "Sending response:\n" << response_str << std::endl;
+        // Reading stops while an HTTP/1.1 response is pending so pipelined input
+        // is not buffered without bound; resume_later() re-arms it.
+        static uint32_t read_interest(const Connection& conn) {
+            return conn.awaiting_response ? 0u : static_cast<uint32_t>(EPOLLIN);
+        }
 
-                    if (send(new_socket, response_str.c_str(), response_str.length(), 0) < 0) {
-                        std::cerr << "Send failed" << std::endl;
+        void start_http2(Connection& conn) {
+            int fd = conn.fd;
+            uint64_t id = conn.id;
+            conn.h2 = std::make_unique<http::h2::Session>(
+                    conn.out,
+                    [this, fd, id](const Request& req, http::h2::Session::Respond respond) {
+                        http::trace::RequestTrace traced = http::trace::begin_request();
+                        http::trace::Scope tracing(traced.id);
+                        serve(req, [this, fd, id, traced, respond = std::move(respond)](Response response) {
+                            if (!find_connection(fd, id)) return;
+                            http::trace::Scope tracing(traced.id);
+                            respond(std::move(response));
+                            http::trace::RequestTrace finished = traced;
+                            http::trace::end_request(finished);
+                            if (fd != current_fd) resume_later(fd, id);
+                        });
+                    },
+                    request_arena(conn).resource());
+            conn.h2->start();
+        }
+
+        static bool is_h2c_upgrade(const Request& req) {
+            return http::header_has_token(req.get_header("Upgrade"), "h2c") && req.has_header("HTTP2-Settings");
+        }
+
+        // Switches conn to the WebSocket protocol if req asks for it on a registered
+        // path. Returns false if no WebSocket route matches.
+        bool upgrade_websocket(Connection& conn, const Request& req) {
+            std::string_view path = std::string_view(req.uri).substr(0, req.uri.find('?'));
+            for (const auto& route : websocket_routes) {
+                if (!std::regex_match(path.begin(), path.end(), route.path_regex)) continue;
+
+                conn.out += http::ws::handshake_response(req);
+                conn.ws = std::make_shared<http::ws::WebSocket>(route.handler, std::string(path));
+                int fd = conn.fd;
+                uint64_t id = conn.id;
+                conn.ws->attach(&conn.out, [this, fd, id] {
+                    Connection* conn = find_connection(fd, id);
+                    if (!conn) return;
+                    if (conn->ws->closing() && !conn->close_timer) {
+                        conn->close_timer = loop->call_later(static_cast<int>(websocket_close_timeout.count()), [this, fd, id] {
+                            Connection* conn = find_connection(fd, id);
+                            if (!conn) return;
+                            conn->close_timer = 0;
+                            close_connection(fd);
+                        });
                     }
+                    // Writes for the connection being processed are flushed when
+                    // its event completes; other connections are flushed now.
+                    if (fd != current_fd) flush(*conn);
+                });
+                conn.ws->opened();
+                return true;
+            }
+            return false;
+        }
+
+        // Opens conn.upload if the route find_route() picks for req streams its
+        // body. Returns false if that route buffers. If the handler rejects the request by throwing, a 400
+        // is queued, the connection will close and conn.upload stays empty.
+        bool open_body_stream(Connection& conn, const Request& req) {
+            const Route* route = find_route(req);
+            if (!route || !route->streams_body()) return false;
+            try {
+                // The request is only valid during this call; the handler
+                // copies whatever its BodyStream needs later.
+                auto params = route->extract_params(req.uri, req.resource());
+                conn.upload = std::make_unique<BodyStream>(route->open_stream(req, std::move(params)));
+            } catch (const std::exception& e) {
+                std::cerr << "Error opening streamed request body: " << e.what() << std::endl;
+                write_response(conn, http::HTTP_400_BAD_REQUEST(http::JSON::object({{"error", e.what()}})), false);
+            }
+            return true;
+        }
+
+        // Queues an HTTP/1.1 response. With keep_alive the connection stays open
+        // for further requests, which requires an explicit Content-Length. A
+        // response to HEAD keeps the Content-Length of the body it leaves out;
+        // 204 and 304 responses never have a body.
+        void write_response(Connection& conn, Response resp, bool keep_alive, bool head_request = false) {
+            keep_alive = keep_alive && !draining;
+            if (resp.status == http::HttpStatus::NO_CONTENT || resp.status == http::HttpStatus::NOT_MODIFIED) {
+                resp.body.clear();
+                if (resp.status == http::HttpStatus::NO_CONTENT) {
+                    auto length = http::find_header(resp.headers, "Content-Length");
+                    if (length != resp.headers.end()) resp.headers.erase(length);
+                }
+            } else if (http::find_header(resp.headers, "Content-Length") == resp.headers.end()) {
+                resp.headers["Content-Length"] = std::to_string(resp.body.size());
+            }
+            if (head_request) {
+                resp.body.clear();
+            }
+            if (!keep_alive) {
+                resp.headers["Connection"] = "close";
+            }
+
+            http::trace::Span serializing(http::trace::Phase::SERIALIZE);
+            size_t start = conn.out.size();
+            http::construct_response_to(resp, conn.out);
+            serializing.end();
+            std::cout << "Sending response:\n" << std::string_view(conn.out).substr(start) << std::endl;
+            if (!keep_alive) conn.close_after_write = true;
+        }
+
+        // The request's Content-Length, 0 if absent. nullopt if it is not a
+        // decimal number or repeated with different values.
+        static std::optional<size_t> parse_content_length(const Request& req) {
+            auto it = req.headers.find(std::string_view("Content-Length"));
+            if (it == req.headers.end()) return 0;
+
+            std::optional<size_t> length;
+            std::string_view values = it->second;
+            while (true) {
+                auto comma = values.find(',');
+                std::string_view value = http::trim_view(values.substr(0, comma));
+                size_t parsed;
+                auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), parsed);
+                if (ec != std::errc() || end != value.data() + value.size() || (length && *length != parsed)) {
+                    return std::nullopt;
+                }
+                length = parsed;
+                if (comma == std::string_view::npos) return length;
+                values.remove_prefix(comma + 1);
+            }
+        }
+
+        static bool wants_keep_alive(const Request& req) {
+            std::string connection = req.get_header("Connection");
+            if (req.version.major == 1 && req.version.minor == 0) {
+                return http::header_has_token(connection, "keep-alive");
+            }
+            return !http::header_has_token(connection, "close");
+        }
+
+        Connection* find_connection(int fd, uint64_t id) {
+            auto it = connections.find(fd);
+            if (it == connections.end() || it->second->id != id) return nullptr;
+            return it->second.get();
+        }
+
+        // Processes input buffered behind a deferred response and flushes, from
+        // the top of the loop so the connection's arena is never reset under a handler.
+        void resume_later(int fd, uint64_t id) {
+            loop->call_later(0, [this, fd, id] {
+                Connection* conn = find_connection(fd, id);
+                if (!conn) return;
+                current_fd = fd;
+                try {
+                    if (conn->h2 && conn->h2->closed()) {
+                        conn->close_after_write = true;
+                    }
+                    process_input(*conn);
                 } catch (const std::exception& e) {
                     std::cerr << "Error handling request: " << e.what() << std::endl;
+                    conn->close_after_write = true;
                 }
-                close(new_socket);
+                current_fd = -1;
+                flush(*conn);
+            });
+        }
+
+        // Responder for an HTTP/1.1 request; the response goes out in request
+        // order because later requests wait while awaiting_response is set.
+        Responder http1_responder(Connection& conn, const Request& req) {
+            conn.awaiting_response = true;
+            conn.response_started = std::chrono::steady_clock::now();
+            int fd = conn.fd;
+            uint64_t id = conn.id;
+            bool keep_alive = wants_keep_alive(req);
+            bool head_request = req.method == Method::HEAD;
+            http::trace::RequestTrace traced = std::exchange(conn.request_trace, {});
+            return [this, fd, id, keep_alive, head_request, traced](Response response) {
+                Connection* conn = find_connection(fd, id);
+                if (!conn || !conn->awaiting_response) return;
+                conn->awaiting_response = false;
+                http::trace::Scope tracing(traced.id);
+                write_response(*conn, std::move(response), keep_alive, head_request);
+                queue_trace(*conn, traced);
+                if (fd != current_fd) {
+                    release_arena(*conn);
+                    resume_later(fd, id);
+                }
+            };
+        }
+
+        // Hands a request's trace to flush(), which ends it once the response
+        // has been sent. A trace still waiting there ends now.
+        static void queue_trace(Connection& conn, http::trace::RequestTrace traced) {
+            http::trace::end_request(conn.sending_trace);
+            conn.sending_trace = traced;
+        }
+
+        // Enforces the HTTP/1.1 timeouts: idle keep-alive connections are closed,
+        // requests that arrive too slowly get 408 and handlers that never
+        // respond get 504, both closing the connection.
+        void close_expired_connections(std::chrono::steady_clock::time_point now) {
+            std::vector<int> expired;
+            std::vector<std::pair<int, http::HttpStatus>> timed_out;
+            for (const auto& [fd, conn] : connections) {
+                if (conn->h2 || conn->ws || conn->close_after_write) continue;
+                if (conn->awaiting_response) {
+                    if (now - conn->response_started >= response_timeout) {
+                        timed_out.emplace_back(fd, http::HttpStatus::GATEWAY_TIMEOUT);
+                    }
+                } else if (conn->upload) {
+                    if (now - conn->last_active >= request_timeout) {
+                        timed_out.emplace_back(fd, http::HttpStatus::REQUEST_TIMEOUT);
+                    }
+                } else if (!conn->in.empty()) {
+                    if (now - conn->request_started >= request_timeout) {
+                        timed_out.emplace_back(fd, http::HttpStatus::REQUEST_TIMEOUT);
+                    }
+                } else if (conn->out_offset >= conn->out.size() && now - conn->last_active >= keep_alive_timeout) {
+                    expired.push_back(fd);
+                }
+            }
+            for (int fd : expired) {
+                close_connection(fd);
             }
+            for (const auto& [fd, status] : timed_out) {
+                auto it = connections.find(fd);
+                if (it == connections.end()) continue;
+                Connection& conn = *it->second;
+                const char* error = status == http::HttpStatus::GATEWAY_TIMEOUT ? "Handler did not respond in time"
+                                                                                : "Request not received in time";
+                std::cerr << error << std::endl;
+                conn.awaiting_response = false;
+                write_response(conn, http::custom_response(status, http::JSON::object({{"error", error}})), false);
+                flush(conn);
+            }
+        }
 
-            std::cout << "Server stopped" << std::endl;
+        void process_upload(Connection& conn) {
+            http::trace::Scope tracing(conn.request_trace.id);
+            size_t length = std::min(conn.upload_remaining, conn.in.size());
+            try {
+                conn.upload->on_data(std::string_view(conn.in).substr(0, length));
+                conn.in.erase(0, length);
+                conn.upload_remaining -= length;
+                if (conn.upload_remaining > 0) return;
+                write_response(conn, conn.upload->on_complete(), false);
+            } catch (const std::exception& e) {
+                std::cerr << "Error in streamed request body: " << e.what() << std::endl;
+                write_response(conn, http::HTTP_400_BAD_REQUEST(http::JSON::object({{"error", e.what()}})), false);
+            }
+            queue_trace(conn, std::exchange(conn.request_trace, {}));
+            conn.upload.reset();
+            release_arena(conn);
         }
-        void stop() {
-            running = false;
+
+        void process_input(Connection& conn) {
+            while (!conn.in.empty()) {
+                if (conn.upload) {
+                    process_upload(conn);
+                    return;
+                }
+                if (conn.ws) {
+                    size_t used = conn.ws->feed(conn.in.data(), conn.in.size());
+                    conn.in.erase(0, used);
+                    if (conn.ws->finished()) {
+                        conn.close_after_write = true;
+                    }
+                    return;
+                }
+                if (conn.h2) {
+                    size_t used = conn.h2->feed(conn.in);
+                    conn.in.erase(0, used);
+                    release_arena(conn);
+                    if (conn.h2->closed()) {
+                        conn.close_after_write = true;
+                    }
+                    return;
+                }
+                if (conn.close_after_write || conn.awaiting_response) return;
+
+                std::string_view in(conn.in);
+                std::string_view preface = http::h2::connection_preface;
+                size_t prefix = std::min(in.size(), preface.size());
+                if (in.substr(0, prefix) == preface.substr(0, prefix)) {
+                    if (prefix < preface.size()) return;
+                    start_http2(conn);
+                    continue;
+                }
+
+                if (conn.pending_request_size > in.size()) return;
+
+                auto header_end = in.find("\r\n\r\n");
+                if (header_end == std::string_view::npos) {
+                    if (in.size() > max_header_size) {
+                        conn.close_after_write = true;
+                    }
+                    return;
+                }
+
+                size_t consumed;
+                {
+                    // A request is sampled once, when its head is first parsed.
+                    if (conn.pending_request_size == 0) conn.request_trace = http::trace::begin_request();
+                    http::trace::Scope tracing(conn.request_trace.id);
+                    http::trace::Span parsing(http::trace::Phase::PARSE);
+                    Request req = http::parse_request(in.substr(0, header_end + 4), request_arena(conn).resource());
+                    parsing.end();
+                    // Bodies are only framed by Content-Length; guessing at any
+                    // other framing would let body bytes pass as pipelined requests.
+                    if (req.has_header("Transfer-Encoding")) {
+                        write_response(conn, Response{{1, 1}, http::HttpStatus::NOT_IMPLEMENTED,
+                                                      {{"Content-Type", "application/json"}},
+                                                      http::JSON::object({{"error", "Transfer-Encoding is not supported"}}).stringify()},
+                                       false);
+                        return;
+                    }
+                    auto length = parse_content_length(req);
+                    if (!length) {
+                        write_response(conn, http::HTTP_400_BAD_REQUEST(http::JSON::object({{"error", "Invalid Content-Length"}})), false);
+                        return;
+                    }
+                    size_t content_length = *length;
+                    bool expects_continue = http::iequals(req.get_header("Expect"), "100-continue");
+
+                    if (content_length > 0 && conn.pending_request_size == 0 && open_body_stream(conn, req)) {
+                        if (!conn.upload) return;
+                        std::cout << "Streaming request body: " << method_to_string(req.method) << " " << req.uri << std::endl;
+                        if (expects_continue) conn.out += "HTTP/1.1 100 Continue\r\n\r\n";
+                        conn.upload_remaining = content_length;
+                        consumed = header_end + 4;
+                    } else {
+                        if (content_length > max_body_size) {
+                            conn.close_after_write = true;
+                            return;
+                        }
+
+                        consumed = header_end + 4 + content_length;
+                        if (in.size() < consumed) {
+                            if (conn.pending_request_size == 0 && expects_continue) {
+                                conn.out += "HTTP/1.1 100 Continue\r\n\r\n";
+                            }
+                            conn.pending_request_size = consumed;
+                            return;
+                        }
+                        conn.pending_request_size = 0;
+                        req.body.assign(in.substr(header_end + 4, content_length));
+                        dispatch_buffered(conn, req, in.substr(0, consumed));
+                    }
+                }
+                conn.in.erase(0, consumed);
+                conn.request_started = std::chrono::steady_clock::now();
+                release_arena(conn);
+            }
+        }
+
+        void dispatch_buffered(Connection& conn, const Request& req, std::string_view raw) {
+            std::cout << "Received request:\n" << raw << std::endl;
+            bool keep_alive = wants_keep_alive(req) && !draining;
+
+            if (http::ws::is_upgrade_request(req) && upgrade_websocket(conn, req)) {
+                // Remaining input (if any) is WebSocket frames.
+            } else if (is_h2c_upgrade(req)) {
+                conn.out += "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+                start_http2(conn);
+                conn.h2->apply_upgrade_settings(req.get_header("HTTP2-Settings"));
+                conn.h2->upgrade(req);
+            } else if (const std::string* wire = find_static_response(req, keep_alive)) {
+                send_static(conn, *wire, keep_alive);
+                queue_trace(conn, std::exchange(conn.request_trace, {}));
+            } else {
+                serve(req, http1_responder(conn, req));
+            }
+            http::trace::end_request(conn.request_trace);
+        }
+
+        // Returns the precomputed bytes if the route that would handle req is static.
+        // HEAD is never answered from these bytes, which include the body;
+        // write_response() strips it instead.
+        const std::string* find_static_response(const Request& req, bool keep_alive) const {
+            if (req.method == Method::HEAD) return nullptr;
+            http::trace::Span routing(http::trace::Phase::ROUTE);
+            const Route* route = find_route(req);
+            return route ? route->wire_response(req, keep_alive) : nullptr;
+        }
+
+        // Sends any pending output followed by a static response with one
+        // writev, without copying the response into conn.out unless the socket
+        // does not take all of it.
+        void send_static(Connection& conn, const std::string& wire, bool keep_alive) {
+            if (!keep_alive || draining) conn.close_after_write = true;
+            iovec iov[2] = {
+                    {conn.out.data() + conn.out_offset, conn.out.size() - conn.out_offset},
+                    {const_cast<char*>(wire.data()), wire.size()}
+            };
+            ssize_t sent;
+            {
+                http::trace::Span sending(http::trace::Phase::SEND);
+                do {
+                    sent = writev(conn.fd, iov, 2);
+                } while (sent < 0 && errno == EINTR);
+            }
+            if (sent < 0) {
+                // Let flush() report the error or wait for EPOLLOUT.
+                conn.out += wire;
+                return;
+            }
+
+            size_t written = static_cast<size_t>(sent);
+            if (written < iov[0].iov_len) {
+                conn.out_offset += written;
+                conn.out += wire;
+                return;
+            }
+            written -= iov[0].iov_len;
+            conn.out.clear();
+            conn.out_offset = 0;
+            conn.out.append(wire, written);
+        }
+
+        void dump_trace() {
+            std::string path = "trace-" + std::to_string(getpid()) + ".json";
+            std::ofstream file(path);
+            file << http::trace::chrome_trace_json();
+            if (file) {
+                std::cout << "Trace written to " << path << std::endl;
+            } else {
+                std::cerr << "Failed to write trace to " << path << std::endl;
+            }
+        }
+
+        // Only touches lock-free atomics, which is all a signal handler may do.
+        static void signal_handler(int) {
+            if (!instance) return;
+            if (instance->drain_requested) {
+                instance->running = false;
+            } else {
+                instance->drain_requested = true;
+            }
+        }
+
+        // A newer process connected to the handoff socket: give it the listener
+        // and drain. The socket stays open in the new process, so no connection
+        // attempt is refused during the upgrade.
+        void hand_off_listener() {
+            int peer = accept4(handoff_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (peer < 0) return;
+            bool sent = server_fd >= 0 && send_fd(peer, server_fd);
+            close(peer);
+            if (!sent) {
+                std::cerr << "Failed to hand off listening socket" << std::endl;
+                return;
+            }
+            std::cout << "Listening socket handed off to new process" << std::endl;
+            listener_handed_off = true;
+            begin_drain();
+        }
+
+        void close_listeners() {
             if (server_fd != -1) {
+                if (loop) loop->remove(server_fd);
                 close(server_fd);
                 server_fd = -1;
             }
+            if (handoff_fd != -1) {
+                if (loop) loop->remove(handoff_fd);
+                close(handoff_fd);
+                handoff_fd = -1;
+                // After a handoff the path belongs to the new process.
+                if (!listener_handed_off) unlink(handoff_path.c_str());
+            }
         }
 
-    private:
-        std::vector<std::unique_ptr<Route>> routes;
-        std::atomic<bool> running;
-        int server_fd;
-        static FastAPI* instance;
+        void begin_drain() {
+            draining = true;
+            drain_deadline = std::chrono::steady_clock::now() + drain_timeout;
+            std::cout << "Draining " << connections.size() << " connections..." << std::endl;
+            close_listeners();
 
-        static void signal_handler(int signal) {
-            std::cout << "Received signal " << signal << ". Shutting down..." << std::endl;
-            if (instance) {
-                instance->stop();
+            std::vector<int> fds;
+            fds.reserve(connections.size());
+            for (const auto& [fd, conn] : connections) fds.push_back(fd);
+            for (int fd : fds) {
+                // Closing a WebSocket may flush and close its connection.
+                auto it = connections.find(fd);
+                if (it == connections.end()) continue;
+                Connection& conn = *it->second;
+                if (conn.ws) {
+                    conn.ws->close(http::ws::GOING_AWAY, "Server shutting down");
+                } else if (conn.h2) {
+                    conn.h2->shutdown();
+                    if (conn.h2->closed()) conn.close_after_write = true;
+                    flush(conn);
+                }
+            }
+        }
+
+        // Connections with no request in progress and nothing left to send.
+        void close_idle_connections() {
+            auto now = std::chrono::steady_clock::now();
+            std::vector<int> idle;
+            for (const auto& [fd, conn] : connections) {
+                bool busy = conn->out_offset < conn->out.size() || conn->upload || !conn->in.empty() || conn->ws ||
+                            conn->awaiting_response ||
+                            (conn->h2 && conn->h2->active_streams() > 0) ||
+                            (!conn->h2 && now - conn->accepted_at < drain_accept_grace);
+                if (!busy) idle.push_back(fd);
+            }
+            for (int fd : idle) {
+                close_connection(fd);
             }
         }
     };
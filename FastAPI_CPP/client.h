@@ -0,0 +1,698 @@
+// Tomas Costantino
+
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include "http_lib.h"
+#include "event_loop.h"
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <iostream>
+#include <cstring>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+
+namespace http {
+
+    struct Url {
+        std::string host;
+        int port = 80;
+        // Path and query, e.g. "/items?id=1".
+        std::string target = "/";
+    };
+
+    // Splits an absolute http:// URL. IPv6 hosts are written in brackets.
+    inline Url parse_url(std::string_view url) {
+        constexpr std::string_view scheme = "http://";
+        if (url.size() < scheme.size() || !iequals(url.substr(0, scheme.size()), scheme)) {
+            throw std::runtime_error("Only http:// URLs are supported: " + std::string(url));
+        }
+        url.remove_prefix(scheme.size());
+
+        Url result;
+        auto target_start = url.find_first_of("/?");
+        std::string_view authority = url.substr(0, target_start);
+        if (target_start != std::string_view::npos) {
+            result.target = url.substr(target_start);
+            if (result.target.front() == '?') result.target.insert(0, "/");
+        }
+
+        std::string_view port;
+        if (!authority.empty() && authority.front() == '[') {
+            auto close = authority.find(']');
+            if (close == std::string_view::npos) throw std::runtime_error("Invalid URL host: " + std::string(authority));
+            result.host = authority.substr(1, close - 1);
+            authority.remove_prefix(close + 1);
+            if (!authority.empty() && authority.front() == ':') port = authority.substr(1);
+        } else {
+            auto colon = authority.rfind(':');
+            result.host = authority.substr(0, colon);
+            if (colon != std::string_view::npos) port = authority.substr(colon + 1);
+        }
+        if (result.host.empty()) throw std::runtime_error("URL has no host: " + std::string(url));
+        if (!port.empty() &&
+            (std::from_chars(port.data(), port.data() + port.size(), result.port).ec != std::errc() ||
+             result.port <= 0 || result.port > 65535)) {
+            throw std::runtime_error("Invalid URL port: " + std::string(port));
+        }
+        return result;
+    }
+
+    // Incremental HTTP/1.1 response parser: Content-Length, chunked and
+    // close-delimited bodies. Interim 1xx responses are skipped. Malformed
+    // input throws std::runtime_error.
+    class ResponseParser {
+    public:
+        void reset(bool head_request, size_t max_body_size) {
+            *this = ResponseParser();
+            head = head_request;
+            max_size = max_body_size;
+        }
+
+        // Consumes data; returns true once the response is complete.
+        bool feed(std::string_view data) {
+            if (complete) {
+                // Bytes after a complete response cannot be a reply to anything.
+                if (!data.empty()) close_connection = true;
+                return true;
+            }
+            buffer.append(data);
+            while (!headers_done) {
+                auto end = buffer.find("\r\n\r\n");
+                if (end == std::string::npos) {
+                    if (buffer.size() > max_header_size) throw std::runtime_error("Response headers too large");
+                    return false;
+                }
+                parse_head(std::string_view(buffer).substr(0, end + 2));
+                buffer.erase(0, end + 4);
+            }
+            return parse_body();
+        }
+
+        // Called when the peer closes the connection; returns true if that
+        // completed a close-delimited response.
+        bool finish() {
+            if (headers_done && body == Body::UNTIL_CLOSE) {
+                complete = true;
+            }
+            return complete;
+        }
+
+        // True once any byte of the response has arrived.
+        bool started() const {
+            return headers_done || !buffer.empty();
+        }
+
+        bool keep_alive() const {
+            return !close_connection;
+        }
+
+        Response take() {
+            return std::move(response);
+        }
+
+    private:
+        enum class Body { NONE, LENGTH, CHUNKED, UNTIL_CLOSE };
+        enum class Chunk { SIZE, DATA, DATA_END, TRAILERS };
+
+        static constexpr size_t max_header_size = 64 * 1024;
+
+        std::string buffer;
+        Response response{{1, 1}, HttpStatus::OK, {}, {}};
+        Body body = Body::NONE;
+        Chunk chunk = Chunk::SIZE;
+        size_t remaining = 0;
+        size_t max_size = 64 * 1024 * 1024;
+        bool head = false;
+        bool headers_done = false;
+        bool complete = false;
+        bool close_connection = false;
+
+        void parse_head(std::string_view head_block) {
+            std::string_view status_line = next_token(head_block, '\n');
+            if (status_line.size() < 12 || status_line.substr(0, 5) != "HTTP/" || status_line[6] != '.') {
+                throw std::runtime_error("Invalid status line");
+            }
+            response.version = {status_line[5] - '0', status_line[7] - '0'};
+            int status = 0;
+            if (std::from_chars(status_line.data() + 9, status_line.data() + 12, status).ec != std::errc() ||
+                status < 100 || status > 999) {
+                throw std::runtime_error("Invalid status code");
+            }
+            response.status = static_cast<HttpStatus>(status);
+
+            response.headers.clear();
+            while (!head_block.empty()) {
+                std::string_view line = trim_view(next_token(head_block, '\n'));
+                if (line.empty()) continue;
+                auto colon = line.find(':');
+                if (colon == std::string_view::npos) throw std::runtime_error("Invalid response header");
+                std::string name(trim_view(line.substr(0, colon)));
+                std::string_view value = trim_view(line.substr(colon + 1));
+                auto [it, inserted] = response.headers.emplace(name, value);
+                if (!inserted) it->second.append(", ").append(value);
+            }
+
+            // 100 Continue and other interim responses precede the real one.
+            if (status < 200) return;
+            headers_done = true;
+
+            auto connection = find_header(response.headers, "Connection");
+            bool is_http10 = response.version.major == 1 && response.version.minor == 0;
+            close_connection = connection != response.headers.end()
+                               ? header_has_token(connection->second, "close") ||
+                                 (is_http10 && !header_has_token(connection->second, "keep-alive"))
+                               : is_http10;
+
+            auto transfer_encoding = find_header(response.headers, "Transfer-Encoding");
+            auto content_length = find_header(response.headers, "Content-Length");
+            if (head || status == 204 || status == 304) {
+                body = Body::NONE;
+            } else if (transfer_encoding != response.headers.end() && header_has_token(transfer_encoding->second, "chunked")) {
+                body = Body::CHUNKED;
+            } else if (content_length != response.headers.end()) {
+                const std::string& value = content_length->second;
+                if (std::from_chars(value.data(), value.data() + value.size(), remaining).ec != std::errc()) {
+                    throw std::runtime_error("Invalid Content-Length");
+                }
+                if (remaining > max_size) throw std::runtime_error("Response body too large");
+                body = Body::LENGTH;
+            } else {
+                body = Body::UNTIL_CLOSE;
+                close_connection = true;
+            }
+        }
+
+        // Moves up to remaining bytes of buffer into the body.
+        void take_body_bytes() {
+            size_t length = std::min(remaining, buffer.size());
+            response.body.append(buffer, 0, length);
+            buffer.erase(0, length);
+            remaining -= length;
+        }
+
+        bool parse_body() {
+            switch (body) {
+                case Body::NONE:
+                    complete = true;
+                    break;
+                case Body::LENGTH:
+                    take_body_bytes();
+                    complete = remaining == 0;
+                    break;
+                case Body::UNTIL_CLOSE:
+                    response.body += buffer;
+                    buffer.clear();
+                    break;
+                case Body::CHUNKED:
+                    complete = parse_chunks();
+                    break;
+            }
+            if (response.body.size() > max_size) throw std::runtime_error("Response body too large");
+            if (complete && !buffer.empty()) close_connection = true;
+            return complete;
+        }
+
+        bool parse_chunks() {
+            while (true) {
+                if (chunk == Chunk::DATA) {
+                    take_body_bytes();
+                    if (remaining > 0) return false;
+                    chunk = Chunk::DATA_END;
+                }
+                if (chunk == Chunk::DATA_END) {
+                    if (buffer.size() < 2) return false;
+                    if (buffer.compare(0, 2, "\r\n") != 0) throw std::runtime_error("Invalid chunk terminator");
+                    buffer.erase(0, 2);
+                    chunk = Chunk::SIZE;
+                }
+
+                auto line_end = buffer.find("\r\n");
+                if (line_end == std::string::npos) {
+                    if (buffer.size() > max_header_size) throw std::runtime_error("Chunk header too large");
+                    return false;
+                }
+                std::string_view line = std::string_view(buffer).substr(0, line_end);
+
+                if (chunk == Chunk::TRAILERS) {
+                    // Trailer fields are not exposed; the empty line ends the body.
+                    bool last = line.empty();
+                    buffer.erase(0, line_end + 2);
+                    if (last) return true;
+                    continue;
+                }
+
+                std::string_view size_text = trim_view(line.substr(0, line.find(';')));
+                size_t size = 0;
+                auto result = std::from_chars(size_text.data(), size_text.data() + size_text.size(), size, 16);
+                if (size_text.empty() || result.ec != std::errc() || result.ptr != size_text.data() + size_text.size()) {
+                    throw std::runtime_error("Invalid chunk size");
+                }
+                buffer.erase(0, line_end + 2);
+                if (size == 0) {
+                    chunk = Chunk::TRAILERS;
+                } else {
+                    if (response.body.size() + size > max_size) throw std::runtime_error("Response body too large");
+                    remaining = size;
+                    chunk = Chunk::DATA;
+                }
+            }
+        }
+    };
+
+    struct ClientConfig {
+        // Connections per host:port, busy or idle; further requests wait in a queue.
+        size_t max_connections_per_host = 8;
+        // Deadline for each request, including connecting and queueing.
+        int timeout_ms = 30000;
+        // Idle pooled connections are closed after this long.
+        int idle_timeout_ms = 30000;
+        size_t max_response_size = 64 * 1024 * 1024;
+    };
+
+    // Asynchronous HTTP/1.1 client driven by an EventLoop, normally the
+    // server's own (FastAPI::event_loop()), so handlers can call upstream
+    // services without blocking the serving thread. Connections are pooled per
+    // host:port and kept alive between requests. Callbacks always receive a
+    // Response: transport and protocol failures become 502 Bad Gateway and
+    // timeouts 504 Gateway Timeout, each with a JSON {"error": ...} body.
+    class Client {
+    public:
+        using Callback = std::function<void(Response)>;
+
+        explicit Client(EventLoop& loop, ClientConfig config = {}) : loop(loop), config(config) {}
+
+        // Calls still in flight or queued are dropped without running their
+        // callbacks, which could otherwise reenter the Client being destroyed.
+        ~Client() {
+            for (auto& [fd, conn] : connections) {
+                if (conn->timer) loop.cancel(conn->timer);
+                if (conn->call) loop.cancel(conn->call->deadline);
+                loop.remove(fd);
+                close(fd);
+            }
+            for (auto& [key, pool] : pools) {
+                for (const auto& call : pool.waiting) {
+                    loop.cancel(call->deadline);
+                }
+            }
+        }
+
+        Client(const Client&) = delete;
+        Client& operator=(const Client&) = delete;
+
+        // Sends request to the absolute URL in request.uri. Host names are
+        // resolved once per host:port with getaddrinfo, which may block;
+        // numeric addresses never do.
+        void send(Request request, Callback callback) {
+            Url url = parse_url(request.uri);
+            auto call = std::make_unique<Call>();
+            call->host = url.host;
+            call->port = url.port;
+            call->key = url.host + ":" + std::to_string(url.port);
+            call->head = request.method == Method::HEAD;
+            call->idempotent = request.method == Method::GET || request.method == Method::HEAD ||
+                               request.method == Method::PUT || request.method == Method::DELETE ||
+                               request.method == Method::OPTIONS;
+            call->callback = std::move(callback);
+
+            std::string host = url.host.find(':') != std::string::npos ? "[" + url.host + "]" : url.host;
+            if (url.port != 80) host += ":" + std::to_string(url.port);
+            request.uri = url.target;
+            call->wire = construct_request(request, host);
+
+            int id = ++next_call;
+            call->deadline = loop.call_later(config.timeout_ms, [this, id] { expire(id); });
+            call->id = id;
+            start(std::move(call));
+        }
+
+        void get(const std::string& url, Callback callback) {
+            Request request;
+            request.method = Method::GET;
+            request.uri = url;
+            send(std::move(request), std::move(callback));
+        }
+
+        void post(const std::string& url, std::string_view body, Callback callback,
+                  std::string_view content_type = "application/json") {
+            Request request;
+            request.method = Method::POST;
+            request.uri = url;
+            request.headers.emplace("Content-Type", content_type);
+            request.body = body;
+            send(std::move(request), std::move(callback));
+        }
+
+        // Sends all requests concurrently; done receives the responses in the
+        // order of requests once the last one has completed.
+        void send_all(std::vector<Request> requests, std::function<void(std::vector<Response>)> done) {
+            if (requests.empty()) {
+                done({});
+                return;
+            }
+            struct Batch {
+                std::vector<Response> responses;
+                size_t remaining;
+                std::function<void(std::vector<Response>)> done;
+            };
+            auto batch = std::make_shared<Batch>(Batch{std::vector<Response>(requests.size()), requests.size(), std::move(done)});
+            for (size_t i = 0; i < requests.size(); ++i) {
+                send(std::move(requests[i]), [batch, i](Response response) {
+                    batch->responses[i] = std::move(response);
+                    if (--batch->remaining == 0) {
+                        batch->done(std::move(batch->responses));
+                    }
+                });
+            }
+        }
+
+        size_t open_connections() const {
+            return connections.size();
+        }
+
+        size_t idle_connections() const {
+            size_t idle = 0;
+            for (const auto& [key, pool] : pools) idle += pool.idle.size();
+            return idle;
+        }
+
+    private:
+        struct Call {
+            int id = 0;
+            std::string key;
+            std::string host;
+            int port = 80;
+            std::string wire;
+            bool head = false;
+            bool idempotent = false;
+            bool retried = false;
+            EventLoop::TimerId deadline = 0;
+            Callback callback;
+        };
+
+        struct Connection {
+            int fd;
+            std::string key;
+            bool connecting = true;
+            // Set once the connection has completed a response and been pooled.
+            bool reused = false;
+            std::string out;
+            size_t out_offset = 0;
+            ResponseParser parser;
+            std::unique_ptr<Call> call;
+            // Idle timeout while pooled.
+            EventLoop::TimerId timer = 0;
+        };
+
+        struct Pool {
+            sockaddr_storage address{};
+            socklen_t address_length = 0;
+            size_t open = 0;
+            std::vector<int> idle;
+            std::deque<std::unique_ptr<Call>> waiting;
+        };
+
+        EventLoop& loop;
+        ClientConfig config;
+        int next_call = 0;
+        std::unordered_map<std::string, Pool> pools;
+        std::unordered_map<int, std::unique_ptr<Connection>> connections;
+
+        static Response error_response(HttpStatus status, const std::string& message) {
+            return custom_response(status, JSON::object({{"error", message}}));
+        }
+
+        void start(std::unique_ptr<Call> call) {
+            Pool& pool = pools[call->key];
+            // Most recently used first: it is the least likely to have timed out.
+            while (!pool.idle.empty()) {
+                int fd = pool.idle.back();
+                pool.idle.pop_back();
+                auto it = connections.find(fd);
+                if (it != connections.end()) {
+                    assign(*it->second, std::move(call));
+                    return;
+                }
+            }
+            if (pool.open >= config.max_connections_per_host) {
+                pool.waiting.push_back(std::move(call));
+                return;
+            }
+
+            Connection* conn;
+            try {
+                conn = open_connection(pool, *call);
+            } catch (const std::exception& e) {
+                complete(std::move(call), error_response(HttpStatus::BAD_GATEWAY, e.what()));
+                return;
+            }
+            assign(*conn, std::move(call));
+        }
+
+        // Gives a connection slot freed on key's pool to the next queued call.
+        void start_waiting(const std::string& key) {
+            auto it = pools.find(key);
+            if (it == pools.end()) return;
+            Pool& pool = it->second;
+            if (pool.waiting.empty() || (pool.idle.empty() && pool.open >= config.max_connections_per_host)) return;
+            auto call = std::move(pool.waiting.front());
+            pool.waiting.pop_front();
+            start(std::move(call));
+        }
+
+        static void resolve(Pool& pool, const std::string& host, int port) {
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_flags = AI_NUMERICSERV;
+            addrinfo* result = nullptr;
+            int status = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &result);
+            if (status != 0 || !result) {
+                throw std::runtime_error("Cannot resolve " + host + ": " + gai_strerror(status));
+            }
+            std::memcpy(&pool.address, result->ai_addr, result->ai_addrlen);
+            pool.address_length = result->ai_addrlen;
+            freeaddrinfo(result);
+        }
+
+        Connection* open_connection(Pool& pool, const Call& call) {
+            if (pool.address_length == 0) {
+                resolve(pool, call.host, call.port);
+            }
+            int fd = socket(pool.address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                throw std::runtime_error("Socket creation failed");
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            if (connect(fd, reinterpret_cast<sockaddr*>(&pool.address), pool.address_length) < 0 && errno != EINPROGRESS) {
+                std::string error = std::strerror(errno);
+                close(fd);
+                throw std::runtime_error("Connect to " + call.key + " failed: " + error);
+            }
+
+            auto conn = std::make_unique<Connection>();
+            conn->fd = fd;
+            conn->key = call.key;
+            Connection* raw = conn.get();
+            connections[fd] = std::move(conn);
+            ++pool.open;
+            loop.add(fd, EPOLLOUT, [this, fd](uint32_t events) { on_event(fd, events); });
+            return raw;
+        }
+
+        void assign(Connection& conn, std::unique_ptr<Call> call) {
+            if (conn.timer) {
+                loop.cancel(conn.timer);
+                conn.timer = 0;
+            }
+            conn.out = call->wire;
+            conn.out_offset = 0;
+            conn.parser.reset(call->head, config.max_response_size);
+            conn.call = std::move(call);
+            if (!conn.connecting) write(conn);
+        }
+
+        void close_connection(int fd) {
+            auto it = connections.find(fd);
+            if (it == connections.end()) return;
+            Connection& conn = *it->second;
+            if (conn.timer) loop.cancel(conn.timer);
+            loop.remove(fd);
+            close(fd);
+
+            Pool& pool = pools[conn.key];
+            --pool.open;
+            pool.idle.erase(std::remove(pool.idle.begin(), pool.idle.end(), fd), pool.idle.end());
+            connections.erase(it);
+        }
+
+        // Runs the callback; an exception from it must not unwind through the
+        // event loop and take the server down with it.
+        void complete(std::unique_ptr<Call> call, Response response) {
+            loop.cancel(call->deadline);
+            try {
+                call->callback(std::move(response));
+            } catch (const std::exception& e) {
+                std::cerr << "Error in client callback: " << e.what() << std::endl;
+            }
+        }
+
+        // Ends conn's current call with an error. Requests that failed on a
+        // reused connection before any response byte arrived are retried once
+        // on a fresh connection if idempotent: the server most likely closed
+        // the idle connection while the request was in flight.
+        void fail(Connection& conn, const std::string& message, bool retryable) {
+            auto call = std::move(conn.call);
+            bool reused = conn.reused;
+            std::string key = conn.key;
+            close_connection(conn.fd);
+
+            if (call && retryable && reused && call->idempotent && !call->retried) {
+                call->retried = true;
+                start(std::move(call));
+                return;
+            }
+            start_waiting(key);
+            if (call) complete(std::move(call), error_response(HttpStatus::BAD_GATEWAY, message));
+        }
+
+        void expire(int id) {
+            for (auto& [key, pool] : pools) {
+                for (auto it = pool.waiting.begin(); it != pool.waiting.end(); ++it) {
+                    if ((*it)->id != id) continue;
+                    auto call = std::move(*it);
+                    pool.waiting.erase(it);
+                    std::string message = "Request to " + call->key + " timed out";
+                    complete(std::move(call), error_response(HttpStatus::GATEWAY_TIMEOUT, message));
+                    return;
+                }
+            }
+            for (auto& [fd, conn] : connections) {
+                if (!conn->call || conn->call->id != id) continue;
+                auto call = std::move(conn->call);
+                std::string key = conn->key;
+                close_connection(fd);
+                start_waiting(key);
+                complete(std::move(call), error_response(HttpStatus::GATEWAY_TIMEOUT, "Request to " + key + " timed out"));
+                return;
+            }
+        }
+
+        void on_event(int fd, uint32_t events) {
+            auto it = connections.find(fd);
+            if (it == connections.end()) return;
+            Connection& conn = *it->second;
+
+            if (conn.connecting) {
+                int error = 0;
+                socklen_t length = sizeof(error);
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length);
+                if (error != 0 || (events & (EPOLLERR | EPOLLHUP))) {
+                    fail(conn, "Connect to " + conn.key + " failed: " + std::strerror(error ? error : ECONNREFUSED), false);
+                    return;
+                }
+                conn.connecting = false;
+                write(conn);
+                return;
+            }
+
+            if (!conn.call) {
+                // A pooled connection became readable: the server closed it.
+                close_connection(fd);
+                return;
+            }
+
+            if ((events & EPOLLOUT) && !write(conn)) return;
+            if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) read(conn);
+        }
+
+        // Sends as much of the request as the socket takes. Returns false if the
+        // connection was closed.
+        bool write(Connection& conn) {
+            while (conn.out_offset < conn.out.size()) {
+                ssize_t sent = ::send(conn.fd, conn.out.data() + conn.out_offset, conn.out.size() - conn.out_offset, MSG_NOSIGNAL);
+                if (sent < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        loop.modify(conn.fd, EPOLLIN | EPOLLOUT);
+                        return true;
+                    }
+                    fail(conn, std::string("Send failed: ") + std::strerror(errno), true);
+                    return false;
+                }
+                conn.out_offset += sent;
+            }
+            loop.modify(conn.fd, EPOLLIN);
+            return true;
+        }
+
+        void read(Connection& conn) {
+            char buffer[16384];
+            while (true) {
+                ssize_t received = recv(conn.fd, buffer, sizeof(buffer), 0);
+                if (received > 0) {
+                    bool done;
+                    try {
+                        done = conn.parser.feed(std::string_view(buffer, received));
+                    } catch (const std::exception& e) {
+                        fail(conn, e.what(), false);
+                        return;
+                    }
+                    if (done) {
+                        finish(conn);
+                        return;
+                    }
+                    continue;
+                }
+                if (received == 0) {
+                    if (conn.parser.finish()) {
+                        finish(conn);
+                    } else {
+                        fail(conn, "Connection closed before the response was complete", !conn.parser.started());
+                    }
+                    return;
+                }
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+                fail(conn, std::string("Read failed: ") + std::strerror(errno), !conn.parser.started());
+                return;
+            }
+        }
+
+        void finish(Connection& conn) {
+            auto call = std::move(conn.call);
+            Response response = conn.parser.take();
+            std::string key = conn.key;
+            int fd = conn.fd;
+
+            if (conn.parser.keep_alive()) {
+                conn.reused = true;
+                pools[key].idle.push_back(fd);
+                loop.modify(fd, EPOLLIN);
+                conn.timer = loop.call_later(config.idle_timeout_ms, [this, fd] {
+                    auto it = connections.find(fd);
+                    if (it == connections.end()) return;
+                    it->second->timer = 0;
+                    close_connection(fd);
+                });
+            } else {
+                close_connection(fd);
+            }
+
+            start_waiting(key);
+            complete(std::move(call), std::move(response));
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,158 @@
+// Tomas Costantino
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include "http_lib.h"
+#include <string>
+#include <string_view>
+#include <map>
+#include <stdexcept>
+#include <zlib.h>
+
+namespace http {
+
+    enum class ContentCoding {
+        IDENTITY,
+        GZIP,
+        DEFLATE
+    };
+
+    inline const char* content_coding_name(ContentCoding coding) {
+        switch (coding) {
+            case ContentCoding::GZIP: return "gzip";
+            case ContentCoding::DEFLATE: return "deflate";
+            default: return "identity";
+        }
+    }
+
+    struct CompressionConfig {
+        bool enabled = false;
+        // Bodies smaller than this are sent as-is; compression would not pay off.
+        size_t min_size = 1024;
+        // zlib level: 1 (fastest) to 9 (smallest), or Z_DEFAULT_COMPRESSION.
+        int level = Z_DEFAULT_COMPRESSION;
+    };
+
+    // Picks the coding with the highest q-value in an Accept-Encoding header,
+    // preferring gzip over deflate on ties. Returns IDENTITY if neither is acceptable.
+    inline ContentCoding negotiate_encoding(std::string_view accept_encoding) {
+        double gzip_q = 0, deflate_q = 0, wildcard_q = -1;
+        bool gzip_listed = false, deflate_listed = false;
+
+        while (!accept_encoding.empty()) {
+            std::string_view item = trim_view(next_token(accept_encoding, ','));
+            std::string_view coding = trim_view(item.substr(0, item.find(';')));
+            double q = 1;
+            auto q_pos = item.find("q=");
+            if (q_pos != std::string_view::npos) {
+                std::string_view value = trim_view(item.substr(q_pos + 2));
+                if (std::from_chars(value.data(), value.data() + value.size(), q).ec != std::errc()) q = 0;
+            }
+
+            if (iequals(coding, "gzip") || iequals(coding, "x-gzip")) {
+                gzip_q = q;
+                gzip_listed = true;
+            } else if (iequals(coding, "deflate")) {
+                deflate_q = q;
+                deflate_listed = true;
+            } else if (coding == "*") {
+                wildcard_q = q;
+            }
+        }
+
+        if (!gzip_listed && wildcard_q >= 0) gzip_q = wildcard_q;
+        if (!deflate_listed && wildcard_q >= 0) deflate_q = wildcard_q;
+        if (gzip_q <= 0 && deflate_q <= 0) return ContentCoding::IDENTITY;
+        return gzip_q >= deflate_q ? ContentCoding::GZIP : ContentCoding::DEFLATE;
+    }
+
+    // Text-like media types; images, video and archives are already compressed.
+    inline bool is_compressible_type(std::string_view content_type) {
+        std::string_view type = trim_view(content_type.substr(0, content_type.find(';')));
+        if (type.size() >= 5 && iequals(type.substr(0, 5), "text/")) return true;
+        static constexpr std::string_view types[] = {
+                "application/json", "application/javascript", "application/xml",
+                "application/x-www-form-urlencoded", "image/svg+xml"
+        };
+        for (std::string_view candidate : types) {
+            if (iequals(type, candidate)) return true;
+        }
+        return (type.size() > 5 && iequals(type.substr(type.size() - 5), "+json")) ||
+               (type.size() > 4 && iequals(type.substr(type.size() - 4), "+xml"));
+    }
+
+    // Compresses data in one pass into a gzip or zlib ("deflate") stream.
+    inline std::string compress(std::string_view data, ContentCoding coding, int level = Z_DEFAULT_COMPRESSION) {
+        if (coding == ContentCoding::IDENTITY) {
+            throw std::invalid_argument("compress needs gzip or deflate");
+        }
+        z_stream stream{};
+        // 15-bit window; +16 selects the gzip wrapper. HTTP "deflate" is the zlib format.
+        int window_bits = coding == ContentCoding::GZIP ? 15 + 16 : 15;
+        if (deflateInit2(&stream, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            throw std::runtime_error("deflateInit2 failed");
+        }
+
+        // deflateBound() covers the whole output, so one Z_FINISH call completes it.
+        std::string out(deflateBound(&stream, static_cast<uLong>(data.size())), '\0');
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+        stream.avail_in = static_cast<uInt>(data.size());
+        stream.next_out = reinterpret_cast<Bytef*>(out.data());
+        stream.avail_out = static_cast<uInt>(out.size());
+        int result = deflate(&stream, Z_FINISH);
+        out.resize(out.size() - stream.avail_out);
+        deflateEnd(&stream);
+        if (result != Z_STREAM_END) {
+            throw std::runtime_error("deflate failed");
+        }
+        return out;
+    }
+
+    // True if response is large enough, of a compressible type and not
+    // already encoded.
+    inline bool should_compress(const Response& response, const CompressionConfig& config) {
+        if (!config.enabled || response.body.size() < config.min_size) return false;
+        if (find_header(response.headers, "Content-Encoding") != response.headers.end()) return false;
+        auto type = find_header(response.headers, "Content-Type");
+        return type != response.headers.end() && is_compressible_type(type->second);
+    }
+
+    // The coding to use for response given the request's Accept-Encoding.
+    inline ContentCoding choose_encoding(const Response& response, std::string_view accept_encoding,
+                                         const CompressionConfig& config) {
+        if (!should_compress(response, config)) return ContentCoding::IDENTITY;
+        return negotiate_encoding(accept_encoding);
+    }
+
+    // Marks a response whose encoding depends on Accept-Encoding, so shared
+    // caches keep its encodings apart. Applies to the identity form as well.
+    inline void add_vary_accept_encoding(Response& response) {
+        auto vary = find_header(response.headers, "Vary");
+        if (vary == response.headers.end()) {
+            response.headers["Vary"] = "Accept-Encoding";
+        } else if (!header_has_token(vary->second, "Accept-Encoding")) {
+            response.headers[vary->first] += ", Accept-Encoding";
+        }
+    }
+
+    // Replaces the body with its encoded form and sets the matching headers.
+    inline void encode_response(Response& response, ContentCoding coding, int level) {
+        if (coding == ContentCoding::IDENTITY) return;
+
+        response.body = compress(response.body, coding, level);
+        response.headers["Content-Encoding"] = content_coding_name(coding);
+        auto length = find_header(response.headers, "Content-Length");
+        if (length != response.headers.end()) {
+            response.headers[length->first] = std::to_string(response.body.size());
+        }
+    }
+
+    inline void compress_response(Response& response, std::string_view accept_encoding, const CompressionConfig& config) {
+        if (!should_compress(response, config)) return;
+        add_vary_accept_encoding(response);
+        encode_response(response, negotiate_encoding(accept_encoding), config.level);
+    }
+}
+
+#endif
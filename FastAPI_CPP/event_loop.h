@@ -0,0 +1,172 @@
+// Tomas Costantino
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <functional>
+#include <unordered_map>
+#include <map>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <cerrno>
+#include <cstdint>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+namespace http {
+
+    // Minimal epoll reactor. Every registered fd gets a callback that is invoked
+    // with the ready epoll events; callbacks may add or remove any fd, including
+    // their own, while the loop is dispatching. One-shot timers run after the
+    // fd callbacks of the same iteration.
+    class EventLoop {
+    public:
+        using Callback = std::function<void(uint32_t events)>;
+        using TimerId = uint64_t;
+
+        EventLoop() {
+            epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            if (epoll_fd < 0) {
+                throw std::runtime_error("epoll_create1 failed");
+            }
+        }
+
+        ~EventLoop() {
+            close(epoll_fd);
+        }
+
+        EventLoop(const EventLoop&) = delete;
+        EventLoop& operator=(const EventLoop&) = delete;
+
+        void add(int fd, uint32_t events, Callback callback) {
+            uint32_t generation = ++next_generation;
+            epoll_event event{};
+            event.events = events;
+            event.data.u64 = (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+                throw std::runtime_error("epoll_ctl add failed");
+            }
+            handlers[fd] = Handler{generation, events, std::make_shared<Callback>(std::move(callback))};
+        }
+
+        void modify(int fd, uint32_t events) {
+            auto it = handlers.find(fd);
+            if (it == handlers.end() || it->second.events == events) return;
+
+            epoll_event event{};
+            event.events = events;
+            event.data.u64 = (static_cast<uint64_t>(it->second.generation) << 32) | static_cast<uint32_t>(fd);
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) == 0) {
+                it->second.events = events;
+            }
+        }
+
+        void remove(int fd) {
+            if (handlers.erase(fd) > 0) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+            }
+        }
+
+        bool contains(int fd) const {
+            return handlers.find(fd) != handlers.end();
+        }
+
+        size_t size() const {
+            return handlers.size();
+        }
+
+        // Runs callback once, from the loop, after delay_ms (0 means the next
+        // iteration). The returned id can be passed to cancel().
+        TimerId call_later(int delay_ms, std::function<void()> callback) {
+            TimerId id = ++next_timer;
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms);
+            timers.emplace(std::make_pair(deadline, id), std::move(callback));
+            timer_deadlines.emplace(id, deadline);
+            return id;
+        }
+
+        // Cancels a pending timer; ids that already ran are ignored.
+        void cancel(TimerId id) {
+            auto it = timer_deadlines.find(id);
+            if (it == timer_deadlines.end()) return;
+            timers.erase(std::make_pair(it->second, id));
+            timer_deadlines.erase(it);
+        }
+
+        // Waits up to timeout_ms (or until the next timer) for events and
+        // dispatches them, then runs due timers. Returns the number of callbacks
+        // invoked.
+        int run_once(int timeout_ms) {
+            if (!timers.empty()) {
+                auto until_timer = std::chrono::ceil<std::chrono::milliseconds>(
+                        timers.begin()->first.first - std::chrono::steady_clock::now()).count();
+                until_timer = std::max<decltype(until_timer)>(until_timer, 0);
+                if (timeout_ms < 0 || until_timer < timeout_ms) timeout_ms = static_cast<int>(until_timer);
+            }
+
+            epoll_event events[128];
+            int ready = epoll_wait(epoll_fd, events, 128, timeout_ms);
+            if (ready < 0) {
+                if (errno == EINTR) return run_timers();
+                throw std::runtime_error("epoll_wait failed");
+            }
+
+            int dispatched = 0;
+            for (int i = 0; i < ready; ++i) {
+                int fd = static_cast<int>(events[i].data.u64 & 0xffffffffu);
+                uint32_t generation = static_cast<uint32_t>(events[i].data.u64 >> 32);
+
+                // Skip events for fds that were removed (or closed and reused) by
+                // an earlier callback in this batch.
+                auto it = handlers.find(fd);
+                if (it == handlers.end() || it->second.generation != generation) continue;
+
+                auto callback = it->second.callback;
+                (*callback)(events[i].events);
+                ++dispatched;
+            }
+            return dispatched + run_timers();
+        }
+
+        static void set_non_blocking(int fd) {
+            int flags = fcntl(fd, F_GETFL, 0);
+            if (flags >= 0) {
+                fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+            }
+        }
+
+    private:
+        struct Handler {
+            uint32_t generation;
+            uint32_t events;
+            std::shared_ptr<Callback> callback;
+        };
+
+        using TimerKey = std::pair<std::chrono::steady_clock::time_point, TimerId>;
+
+        int epoll_fd;
+        uint32_t next_generation = 0;
+        std::unordered_map<int, Handler> handlers;
+        TimerId next_timer = 0;
+        std::map<TimerKey, std::function<void()>> timers;
+        std::unordered_map<TimerId, std::chrono::steady_clock::time_point> timer_deadlines;
+
+        int run_timers() {
+            int ran = 0;
+            auto now = std::chrono::steady_clock::now();
+            // Timers that callbacks add here are normally due after now and wait
+            // for the next iteration.
+            while (!timers.empty() && timers.begin()->first.first <= now) {
+                auto node = timers.extract(timers.begin());
+                timer_deadlines.erase(node.key().second);
+                node.mapped()();
+                ++ran;
+            }
+            return ran;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,469 @@
+// Tomas Costantino
+
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <stdexcept>
+#include <cstdint>
+#include <algorithm>
+
+namespace http::hpack {
+
+    // Raised for malformed header blocks; HTTP/2 maps it to COMPRESSION_ERROR.
+    class DecodingError : public std::runtime_error {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    using HeaderField = std::pair<std::string, std::string>;
+
+    // RFC 7541 Appendix A.
+    inline constexpr std::pair<std::string_view, std::string_view> static_table[] = {
+            {":authority", ""},
+            {":method", "GET"},
+            {":method", "POST"},
+            {":path", "/"},
+            {":path", "/index.html"},
+            {":scheme", "http"},
+            {":scheme", "https"},
+            {":status", "200"},
+            {":status", "204"},
+            {":status", "206"},
+            {":status", "304"},
+            {":status", "400"},
+            {":status", "404"},
+            {":status", "500"},
+            {"accept-charset", ""},
+            {"accept-encoding", "gzip, deflate"},
+            {"accept-language", ""},
+            {"accept-ranges", ""},
+            {"accept", ""},
+            {"access-control-allow-origin", ""},
+            {"age", ""},
+            {"allow", ""},
+            {"authorization", ""},
+            {"cache-control", ""},
+            {"content-disposition", ""},
+            {"content-encoding", ""},
+            {"content-language", ""},
+            {"content-length", ""},
+            {"content-location", ""},
+            {"content-range", ""},
+            {"content-type", ""},
+            {"cookie", ""},
+            {"date", ""},
+            {"etag", ""},
+            {"expect", ""},
+            {"expires", ""},
+            {"from", ""},
+            {"host", ""},
+            {"if-match", ""},
+            {"if-modified-since", ""},
+            {"if-none-match", ""},
+            {"if-range", ""},
+            {"if-unmodified-since", ""},
+            {"last-modified", ""},
+            {"link", ""},
+            {"location", ""},
+            {"max-forwards", ""},
+            {"proxy-authenticate", ""},
+            {"proxy-authorization", ""},
+            {"range", ""},
+            {"referer", ""},
+            {"refresh", ""},
+            {"retry-after", ""},
+            {"server", ""},
+            {"set-cookie", ""},
+            {"strict-transport-security", ""},
+            {"transfer-encoding", ""},
+            {"user-agent", ""},
+            {"vary", ""},
+            {"via", ""},
+            {"www-authenticate", ""},
+    };
+
+    inline constexpr size_t static_table_size = sizeof(static_table) / sizeof(static_table[0]);
+
+    // RFC 7541 Appendix B: (code, bit length) for symbols 0-255 and EOS (256).
+    inline constexpr std::pair<uint32_t, uint8_t> huffman_codes[257] = {
+            {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+            {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+            {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+            {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+            {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+            {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+            {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+            {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+            {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+            {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+            {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+            {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+            {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+            {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+            {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+            {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+            {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+            {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+            {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+            {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+            {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+            {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+            {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+            {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+            {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+            {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+            {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+            {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+            {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+            {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+            {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+            {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+            {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+            {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+            {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+            {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+            {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+            {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+            {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+            {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+            {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+            {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+            {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+            {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+            {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+            {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+            {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+            {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+            {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+            {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+            {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+            {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+            {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+            {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+            {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+            {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+            {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+            {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+            {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+            {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+            {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+            {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+            {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+            {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+            {0x3fffffff, 30},
+    };
+
+    class HuffmanDecoder {
+    public:
+        static std::string decode(std::string_view input) {
+            const auto& tree = instance().nodes;
+            std::string result;
+            result.reserve(input.size() * 8 / 5);
+
+            int node = 0;
+            int bits_since_symbol = 0;
+            bool padding_all_ones = true;
+            for (unsigned char byte : input) {
+                for (int bit = 7; bit >= 0; --bit) {
+                    int b = (byte >> bit) & 1;
+                    node = tree[node].child[b];
+                    if (node < 0) {
+                        throw DecodingError("Invalid Huffman code");
+                    }
+                    ++bits_since_symbol;
+                    padding_all_ones = padding_all_ones && b == 1;
+
+                    int symbol = tree[node].symbol;
+                    if (symbol == 256) {
+                        throw DecodingError("EOS in Huffman string");
+                    }
+                    if (symbol >= 0) {
+                        result += static_cast<char>(symbol);
+                        node = 0;
+                        bits_since_symbol = 0;
+                        padding_all_ones = true;
+                    }
+                }
+            }
+
+            if (bits_since_symbol > 7 || !padding_all_ones) {
+                throw DecodingError("Invalid Huffman padding");
+            }
+            return result;
+        }
+
+    private:
+        struct Node {
+            int child[2] = {-1, -1};
+            int symbol = -1;
+        };
+
+        std::vector<Node> nodes;
+
+        HuffmanDecoder() {
+            nodes.emplace_back();
+            for (int symbol = 0; symbol < 257; ++symbol) {
+                auto [code, length] = huffman_codes[symbol];
+                int node = 0;
+                for (int bit = length - 1; bit >= 0; --bit) {
+                    int b = (code >> bit) & 1;
+                    if (nodes[node].child[b] < 0) {
+                        nodes[node].child[b] = static_cast<int>(nodes.size());
+                        nodes.emplace_back();
+                    }
+                    node = nodes[node].child[b];
+                }
+                nodes[node].symbol = symbol;
+            }
+        }
+
+        static const HuffmanDecoder& instance() {
+            static const HuffmanDecoder decoder;
+            return decoder;
+        }
+    };
+
+    // Dynamic table shared by the decoder and encoder sides. Entry sizes follow
+    // RFC 7541 section 4.1 (name + value + 32 bytes).
+    class DynamicTable {
+    public:
+        explicit DynamicTable(size_t max_size = 4096) : max_size_(max_size) {}
+
+        void insert(std::string name, std::string value) {
+            size_t entry_size = name.size() + value.size() + 32;
+            if (entry_size > max_size_) {
+                entries_.clear();
+                size_ = 0;
+                return;
+            }
+            while (size_ + entry_size > max_size_) {
+                evict();
+            }
+            size_ += entry_size;
+            entries_.emplace_front(std::move(name), std::move(value));
+        }
+
+        void set_max_size(size_t max_size) {
+            max_size_ = max_size;
+            while (size_ > max_size_) {
+                evict();
+            }
+        }
+
+        size_t max_size() const { return max_size_; }
+        size_t count() const { return entries_.size(); }
+
+        // index is 0-based from the most recently inserted entry.
+        const HeaderField& at(size_t index) const { return entries_.at(index); }
+
+    private:
+        std::deque<HeaderField> entries_;
+        size_t size_ = 0;
+        size_t max_size_;
+
+        void evict() {
+            const auto& last = entries_.back();
+            size_ -= last.first.size() + last.second.size() + 32;
+            entries_.pop_back();
+        }
+    };
+
+    inline uint64_t decode_integer(std::string_view block, size_t& pos, int prefix_bits) {
+        if (pos >= block.size()) {
+            throw DecodingError("Truncated integer");
+        }
+        uint64_t max_prefix = (1u << prefix_bits) - 1;
+        uint64_t value = static_cast<unsigned char>(block[pos++]) & max_prefix;
+        if (value < max_prefix) {
+            return value;
+        }
+
+        int shift = 0;
+        while (true) {
+            if (pos >= block.size()) {
+                throw DecodingError("Truncated integer");
+            }
+            unsigned char byte = static_cast<unsigned char>(block[pos++]);
+            value += static_cast<uint64_t>(byte & 0x7f) << shift;
+            shift += 7;
+            if ((byte & 0x80) == 0) break;
+            if (shift > 28) {
+                throw DecodingError("Integer overflow");
+            }
+        }
+        return value;
+    }
+
+    inline void encode_integer(std::string& out, uint64_t value, int prefix_bits, uint8_t first_byte_flags) {
+        uint64_t max_prefix = (1u << prefix_bits) - 1;
+        if (value < max_prefix) {
+            out += static_cast<char>(first_byte_flags | value);
+            return;
+        }
+        out += static_cast<char>(first_byte_flags | max_prefix);
+        value -= max_prefix;
+        while (value >= 128) {
+            out += static_cast<char>((value & 0x7f) | 0x80);
+            value >>= 7;
+        }
+        out += static_cast<char>(value);
+    }
+
+    class Decoder {
+    public:
+        explicit Decoder(size_t max_table_size = 4096)
+                : table_(max_table_size), settings_max_size_(max_table_size) {}
+
+        // Decodes one complete header block. The dynamic table is updated as a side
+        // effect, so blocks must be decoded in the order they were received.
+        std::vector<HeaderField> decode(std::string_view block) {
+            std::vector<HeaderField> headers;
+            size_t pos = 0;
+            bool fields_seen = false;
+            while (pos < block.size()) {
+                unsigned char byte = static_cast<unsigned char>(block[pos]);
+                if (byte & 0x80) {
+                    // Indexed header field.
+                    headers.push_back(lookup(decode_integer(block, pos, 7)));
+                    fields_seen = true;
+                } else if (byte & 0x40) {
+                    // Literal with incremental indexing.
+                    HeaderField field = decode_literal(block, pos, 6);
+                    table_.insert(field.first, field.second);
+                    headers.push_back(std::move(field));
+                    fields_seen = true;
+                } else if (byte & 0x20) {
+                    // Dynamic table size update, only allowed at the start of a block.
+                    if (fields_seen) {
+                        throw DecodingError("Table size update after header field");
+                    }
+                    uint64_t size = decode_integer(block, pos, 5);
+                    if (size > settings_max_size_) {
+                        throw DecodingError("Table size update exceeds limit");
+                    }
+                    table_.set_max_size(size);
+                } else {
+                    // Literal without indexing (0000) or never indexed (0001).
+                    headers.push_back(decode_literal(block, pos, 4));
+                    fields_seen = true;
+                }
+            }
+            return headers;
+        }
+
+    private:
+        DynamicTable table_;
+        size_t settings_max_size_;
+
+        HeaderField lookup(uint64_t index) const {
+            if (index == 0) {
+                throw DecodingError("Invalid header index 0");
+            }
+            if (index <= static_table_size) {
+                const auto& [name, value] = static_table[index - 1];
+                return {std::string(name), std::string(value)};
+            }
+            size_t dynamic_index = index - static_table_size - 1;
+            if (dynamic_index >= table_.count()) {
+                throw DecodingError("Header index out of range");
+            }
+            return table_.at(dynamic_index);
+        }
+
+        HeaderField decode_literal(std::string_view block, size_t& pos, int prefix_bits) {
+            uint64_t name_index = decode_integer(block, pos, prefix_bits);
+            std::string name = name_index ? lookup(name_index).first : decode_string(block, pos);
+            std::string value = decode_string(block, pos);
+            return {std::move(name), std::move(value)};
+        }
+
+        static std::string decode_string(std::string_view block, size_t& pos) {
+            if (pos >= block.size()) {
+                throw DecodingError("Truncated string");
+            }
+            bool huffman = static_cast<unsigned char>(block[pos]) & 0x80;
+            uint64_t length = decode_integer(block, pos, 7);
+            if (length > block.size() - pos) {
+                throw DecodingError("String length exceeds block");
+            }
+            std::string_view data = block.substr(pos, length);
+            pos += length;
+            return huffman ? HuffmanDecoder::decode(data) : std::string(data);
+        }
+    };
+
+    // Encoder for response headers. Uses the static table for exact and name
+    // matches and indexes repeated fields into the dynamic table; strings are
+    // emitted as raw literals (Huffman coding is optional for encoders).
+    class Encoder {
+    public:
+        explicit Encoder(size_t max_table_size = 4096) : table_(max_table_size) {}
+
+        // Called when the peer's SETTINGS_HEADER_TABLE_SIZE changes; the update
+        // is signalled at the start of the next header block.
+        void set_max_table_size(size_t max_size) {
+            max_size = std::min<size_t>(max_size, 4096);
+            if (max_size != table_.max_size()) {
+                table_.set_max_size(max_size);
+                pending_size_update_ = true;
+            }
+        }
+
+        void begin_block(std::string& out) {
+            if (pending_size_update_) {
+                encode_integer(out, table_.max_size(), 5, 0x20);
+                pending_size_update_ = false;
+            }
+        }
+
+        void encode(std::string& out, std::string_view name, std::string_view value, bool indexable = true) {
+            size_t name_index = 0;
+            for (size_t i = 0; i < static_table_size; ++i) {
+                if (static_table[i].first == name) {
+                    if (static_table[i].second == value) {
+                        encode_integer(out, i + 1, 7, 0x80);
+                        return;
+                    }
+                    if (name_index == 0) name_index = i + 1;
+                }
+            }
+            for (size_t i = 0; i < table_.count(); ++i) {
+                const auto& entry = table_.at(i);
+                if (entry.first == name) {
+                    size_t index = static_table_size + i + 1;
+                    if (entry.second == value) {
+                        encode_integer(out, index, 7, 0x80);
+                        return;
+                    }
+                    if (name_index == 0) name_index = index;
+                }
+            }
+
+            bool index_it = indexable && name.size() + value.size() + 32 <= table_.max_size() / 2;
+            encode_integer(out, name_index, index_it ? 6 : 4, index_it ? 0x40 : 0x00);
+            if (name_index == 0) {
+                encode_string(out, name);
+            }
+            encode_string(out, value);
+            if (index_it) {
+                table_.insert(std::string(name), std::string(value));
+            }
+        }
+
+    private:
+        DynamicTable table_;
+        bool pending_size_update_ = false;
+
+        static void encode_string(std::string& out, std::string_view value) {
+            encode_integer(out, value.size(), 7, 0x00);
+            out += value;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,667 @@
+// Tomas Costantino
+
+#ifndef HTTP2_H
+#define HTTP2_H
+
+#include "http_lib.h"
+#include "hpack.h"
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+namespace http::h2 {
+
+    inline constexpr std::string_view connection_preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+    enum class FrameType : uint8_t {
+        DATA = 0x0,
+        HEADERS = 0x1,
+        PRIORITY = 0x2,
+        RST_STREAM = 0x3,
+        SETTINGS = 0x4,
+        PUSH_PROMISE = 0x5,
+        PING = 0x6,
+        GOAWAY = 0x7,
+        WINDOW_UPDATE = 0x8,
+        CONTINUATION = 0x9
+    };
+
+    enum Flags : uint8_t {
+        END_STREAM = 0x1,
+        ACK = 0x1,
+        END_HEADERS = 0x4,
+        PADDED = 0x8,
+        PRIORITY_FLAG = 0x20
+    };
+
+    enum class ErrorCode : uint32_t {
+        NO_ERROR = 0x0,
+        PROTOCOL_ERROR = 0x1,
+        INTERNAL_ERROR = 0x2,
+        FLOW_CONTROL_ERROR = 0x3,
+        SETTINGS_TIMEOUT = 0x4,
+        STREAM_CLOSED = 0x5,
+        FRAME_SIZE_ERROR = 0x6,
+        REFUSED_STREAM = 0x7,
+        CANCEL = 0x8,
+        COMPRESSION_ERROR = 0x9,
+        CONNECT_ERROR = 0xa,
+        ENHANCE_YOUR_CALM = 0xb
+    };
+
+    enum class Setting : uint16_t {
+        HEADER_TABLE_SIZE = 0x1,
+        ENABLE_PUSH = 0x2,
+        MAX_CONCURRENT_STREAMS = 0x3,
+        INITIAL_WINDOW_SIZE = 0x4,
+        MAX_FRAME_SIZE = 0x5,
+        MAX_HEADER_LIST_SIZE = 0x6
+    };
+
+    inline constexpr int64_t default_window_size = 65535;
+    inline constexpr int64_t max_window_size = 0x7fffffff;
+    inline constexpr uint32_t default_max_frame_size = 16384;
+
+    struct FrameHeader {
+        uint32_t length;
+        FrameType type;
+        uint8_t flags;
+        uint32_t stream_id;
+    };
+
+    inline uint32_t read_u32(std::string_view data) {
+        return (static_cast<uint32_t>(static_cast<unsigned char>(data[0])) << 24) |
+               (static_cast<uint32_t>(static_cast<unsigned char>(data[1])) << 16) |
+               (static_cast<uint32_t>(static_cast<unsigned char>(data[2])) << 8) |
+               static_cast<uint32_t>(static_cast<unsigned char>(data[3]));
+    }
+
+    inline void write_u32(std::string& out, uint32_t value) {
+        out += static_cast<char>((value >> 24) & 0xff);
+        out += static_cast<char>((value >> 16) & 0xff);
+        out += static_cast<char>((value >> 8) & 0xff);
+        out += static_cast<char>(value & 0xff);
+    }
+
+    inline FrameHeader parse_frame_header(std::string_view data) {
+        FrameHeader header{};
+        header.length = (static_cast<uint32_t>(static_cast<unsigned char>(data[0])) << 16) |
+                        (static_cast<uint32_t>(static_cast<unsigned char>(data[1])) << 8) |
+                        static_cast<uint32_t>(static_cast<unsigned char>(data[2]));
+        header.type = static_cast<FrameType>(data[3]);
+        header.flags = static_cast<uint8_t>(data[4]);
+        header.stream_id = read_u32(data.substr(5)) & 0x7fffffff;
+        return header;
+    }
+
+    inline void write_frame_header(std::string& out, uint32_t length, FrameType type, uint8_t flags, uint32_t stream_id) {
+        out += static_cast<char>((length >> 16) & 0xff);
+        out += static_cast<char>((length >> 8) & 0xff);
+        out += static_cast<char>(length & 0xff);
+        out += static_cast<char>(type);
+        out += static_cast<char>(flags);
+        write_u32(out, stream_id & 0x7fffffff);
+    }
+
+    class ConnectionError : public std::runtime_error {
+    public:
+        ConnectionError(ErrorCode code, const std::string& message) : std::runtime_error(message), code(code) {}
+        ErrorCode code;
+    };
+
+    // Server side of one HTTP/2 connection (RFC 9113). Bytes read from the socket
+    // are passed to feed(); frames to send are appended to the output buffer given
+    // at construction. Every stream that completes is dispatched, and its response
+    // is queued subject to connection and stream flow control whenever the
+    // dispatcher calls respond, which may be after dispatch returns.
+    class Session {
+    public:
+        using Respond = std::function<void(Response)>;
+        using Dispatch = std::function<void(const Request&, Respond)>;
+
+        Session(std::string& out, Dispatch dispatch, std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+                : out(out), dispatch(std::move(dispatch)), resource(resource) {}
+
+        // Queues the server connection preface (our SETTINGS frame).
+        void start() {
+            std::string payload;
+            append_setting(payload, Setting::MAX_CONCURRENT_STREAMS, max_concurrent_streams);
+            append_setting(payload, Setting::INITIAL_WINDOW_SIZE, static_cast<uint32_t>(default_window_size));
+            append_setting(payload, Setting::MAX_FRAME_SIZE, default_max_frame_size);
+            append_setting(payload, Setting::ENABLE_PUSH, 0);
+            write_frame_header(out, payload.size(), FrameType::SETTINGS, 0, 0);
+            out += payload;
+        }
+
+        // Applies the client's HTTP2-Settings header from an "Upgrade: h2c" request.
+        void apply_upgrade_settings(std::string_view header_value) {
+            std::string payload = base64_decode(header_value);
+            if (payload.size() % 6 != 0) {
+                throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "Invalid HTTP2-Settings");
+            }
+            apply_settings(payload);
+        }
+
+        // Answers the request that carried "Upgrade: h2c" as stream 1 (RFC 7540 section 3.2).
+        void upgrade(const Request& request) {
+            last_stream_id = 1;
+            Stream& stream = streams[1];
+            stream.send_window = peer_initial_window_size;
+            stream.remote_closed = true;
+            run_dispatch(1, request);
+        }
+
+        // Consumes complete frames from data and returns how many bytes were used.
+        // Incomplete trailing frames are left for the next call.
+        size_t feed(std::string_view data) {
+            size_t consumed = 0;
+            try {
+                if (!preface_received) {
+                    if (data.size() < connection_preface.size()) {
+                        if (connection_preface.substr(0, data.size()) != data) {
+                            throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "Invalid connection preface");
+                        }
+                        return 0;
+                    }
+                    if (data.substr(0, connection_preface.size()) != connection_preface) {
+                        throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "Invalid connection preface");
+                    }
+                    consumed = connection_preface.size();
+                    preface_received = true;
+                }
+
+                while (!goaway_sent) {
+                    std::string_view rest = data.substr(consumed);
+                    if (rest.size() < 9) break;
+
+                    FrameHeader header = parse_frame_header(rest);
+                    if (header.length > default_max_frame_size) {
+                        throw ConnectionError(ErrorCode::FRAME_SIZE_ERROR, "Frame exceeds SETTINGS_MAX_FRAME_SIZE");
+                    }
+                    if (rest.size() < 9 + header.length) break;
+
+                    consumed += 9 + header.length;
+                    handle_frame(header, rest.substr(9, header.length));
+                }
+            } catch (const ConnectionError& e) {
+                send_goaway(e.code);
+                return data.size();
+            } catch (const hpack::DecodingError& e) {
+                send_goaway(ErrorCode::COMPRESSION_ERROR);
+                return data.size();
+            }
+            return consumed;
+        }
+
+        // True once the connection should be closed after flushing the output.
+        bool closed() const {
+            return goaway_sent || ((peer_goaway || shutting_down) && streams.empty());
+        }
+
+        // Graceful shutdown: announces GOAWAY(NO_ERROR) so the peer opens no new
+        // streams, while streams already open are still served.
+        void shutdown() {
+            if (shutting_down || goaway_sent) return;
+            write_frame_header(out, 8, FrameType::GOAWAY, 0, 0);
+            write_u32(out, last_stream_id);
+            write_u32(out, static_cast<uint32_t>(ErrorCode::NO_ERROR));
+            shutting_down = true;
+        }
+
+        size_t active_streams() const {
+            return streams.size();
+        }
+
+    private:
+        struct Stream {
+            std::string header_block;
+            std::vector<hpack::HeaderField> headers;
+            std::string body;
+            std::string pending;
+            size_t pending_offset = 0;
+            int64_t send_window = default_window_size;
+            bool headers_done = false;
+            bool end_stream_on_headers = false;
+            bool remote_closed = false;
+            bool response_started = false;
+            bool refused = false;
+        };
+
+        std::string& out;
+        Dispatch dispatch;
+        std::pmr::memory_resource* resource;
+
+        hpack::Decoder decoder;
+        hpack::Encoder encoder;
+        std::map<uint32_t, Stream> streams;
+
+        uint32_t max_concurrent_streams = 100;
+        size_t max_body_size = 16 * 1024 * 1024;
+        int64_t connection_send_window = default_window_size;
+        int64_t peer_initial_window_size = default_window_size;
+        uint32_t peer_max_frame_size = default_max_frame_size;
+
+        uint32_t last_stream_id = 0;
+        uint32_t continuation_stream_id = 0;
+        bool preface_received = false;
+        bool settings_received = false;
+        bool goaway_sent = false;
+        bool peer_goaway = false;
+        bool shutting_down = false;
+        // Expires with the Session; deferred responses check it first.
+        std::shared_ptr<int> alive = std::make_shared<int>(0);
+
+        static void append_setting(std::string& payload, Setting id, uint32_t value) {
+            payload += static_cast<char>((static_cast<uint16_t>(id) >> 8) & 0xff);
+            payload += static_cast<char>(static_cast<uint16_t>(id) & 0xff);
+            write_u32(payload, value);
+        }
+
+        void send_goaway(ErrorCode code) {
+            if (goaway_sent) return;
+            write_frame_header(out, 8, FrameType::GOAWAY, 0, 0);
+            write_u32(out, last_stream_id);
+            write_u32(out, static_cast<uint32_t>(code));
+            goaway_sent = true;
+        }
+
+        void send_rst_stream(uint32_t stream_id, ErrorCode code) {
+            write_frame_header(out, 4, FrameType::RST_STREAM, 0, stream_id);
+            write_u32(out, static_cast<uint32_t>(code));
+        }
+
+        void send_window_update(uint32_t stream_id, uint32_t increment) {
+            write_frame_header(out, 4, FrameType::WINDOW_UPDATE, 0, stream_id);
+            write_u32(out, increment);
+        }
+
+        void handle_frame(const FrameHeader& header, std::string_view payload) {
+            if (!settings_received && header.type != FrameType::SETTINGS) {
+                throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "Expected SETTINGS after preface");
+            }
+            if (continuation_stream_id != 0 &&
+                (header.type != FrameType::CONTINUATION || header.stream_id != continuation_stream_id)) {
+                throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "Expected CONTINUATION");
+            }
+
+            switch (header.type) {
+                case FrameType::DATA: handle_data(header, payload); break;
+                case FrameType::HEADERS: handle_headers(header, payload); break;
+                case FrameType::PRIORITY:
+                    if (header.stream_id == 0) throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "PRIORITY on stream 0");
+                    if (payload.size() != 5) throw ConnectionError(ErrorCode::FRAME_SIZE_ERROR, "Invalid PRIORITY size");
+                    break;
+                case FrameType::RST_STREAM: handle_rst_stream(header, payload); break;
+                case FrameType::SETTINGS: handle_settings(header, payload); break;
+                case FrameType::PUSH_PROMISE:
+                    throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "Client sent PUSH_PROMISE");
+                case FrameType::PING: handle_ping(header, payload); break;
+                case FrameType::GOAWAY:
+                    if (header.stream_id != 0) throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "GOAWAY on stream");
+                    peer_goaway = true;
+                    break;
+                case FrameType::WINDOW_UPDATE: handle_window_update(header, payload); break;
+                case FrameType::CONTINUATION: handle_continuation(header, payload); break;
+                default:
+                    // Unknown frame types are ignored (RFC 9113 section 4.1).
+                    break;
+            }
+        }
+
+        static std::string_view strip_padding(const FrameHeader& header, std::string_view payload) {
+            if (!(header.flags & PADDED)) return payload;
+            if (payload.empty()) {
+                throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "Missing pad length");
+            }
+            size_t pad_length = static_cast<unsigned char>(payload[0]);
+            if (pad_length >= payload.size()) {
+                throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "Padding exceeds payload");
+            }
+            return payload.substr(1, payload.size() - 1 - pad_length);
+        }
+
+        void handle_data(const FrameHeader& header, std::string_view payload) {
+            if (header.stream_id == 0) {
+                throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "DATA on stream 0");
+            }
+            // Data is consumed as soon as it arrives, so the connection window is
+            // replenished immediately, padding included.
+            if (header.length > 0) {
+                send_window_update(0, header.length);
+            }
+
+            std::string_view data = strip_padding(header, payload);
+            auto it = streams.find(header.stream_id);
+            if (it == streams.end() || it->second.remote_closed || !it->second.headers_done) {
+                if (header.stream_id > last_stream_id) {
+                    throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "DATA on idle stream");
+                }
+                send_rst_stream(header.stream_id, ErrorCode::STREAM_CLOSED);
+                return;
+            }
+
+            Stream& stream = it->second;
+            if (stream.body.size() + data.size() > max_body_size) {
+                send_rst_stream(header.stream_id, ErrorCode::ENHANCE_YOUR_CALM);
+                streams.erase(it);
+                return;
+            }
+            stream.body += data;
+
+            if (header.flags & END_STREAM) {
+                stream.remote_closed = true;
+                dispatch_stream(header.stream_id, stream);
+            } else if (header.length > 0) {
+                send_window_update(header.stream_id, header.length);
+            }
+        }
+
+        void handle_headers(const FrameHeader& header, std::string_view payload) {
+            if (header.stream_id == 0) {
+                throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "HEADERS on stream 0");
+            }
+
+            std::string_view fragment = strip_padding(header, payload);
+            if (header.flags & PRIORITY_FLAG) {
+                if (fragment.size() < 5) {
+                    throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "Truncated priority");
+                }
+                fragment.remove_prefix(5);
+            }
+
+            auto it = streams.find(header.stream_id);
+            if (it == streams.end()) {
+                if (header.stream_id % 2 == 0 || header.stream_id <= last_stream_id) {
+                    throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "Invalid stream identifier");
+                }
+                last_stream_id = header.stream_id;
+                it = streams.emplace(header.stream_id, Stream{}).first;
+                it->second.send_window = peer_initial_window_size;
+                // The block still has to be decoded to keep the HPACK state in sync.
+                it->second.refused = peer_goaway || shutting_down || streams.size() > max_concurrent_streams;
+            } else if (it->second.remote_closed) {
+                throw ConnectionError(ErrorCode::STREAM_CLOSED, "HEADERS on closed stream");
+            } else if (!(header.flags & END_STREAM)) {
+                throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "Trailers without END_STREAM");
+            }
+
+            Stream& stream = it->second;
+            stream.header_block.assign(fragment);
+            stream.end_stream_on_headers = header.flags & END_STREAM;
+            if (header.flags & END_HEADERS) {
+                finish_headers(header.stream_id, stream);
+            } else {
+                continuation_stream_id = header.stream_id;
+            }
+        }
+
+        void handle_continuation(const FrameHeader& header, std::string_view payload) {
+            if (continuation_stream_id == 0 || header.stream_id != continuation_stream_id) {
+                throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "Unexpected CONTINUATION");
+            }
+            Stream& stream = streams.at(header.stream_id);
+            stream.header_block += payload;
+            if (stream.header_block.size() > max_body_size) {
+                throw ConnectionError(ErrorCode::ENHANCE_YOUR_CALM, "Header block too large");
+            }
+            if (header.flags & END_HEADERS) {
+                continuation_stream_id = 0;
+                finish_headers(header.stream_id, stream);
+            }
+        }
+
+        void finish_headers(uint32_t stream_id, Stream& stream) {
+            auto fields = decoder.decode(stream.header_block);
+            stream.header_block.clear();
+
+            if (stream.refused) {
+                send_rst_stream(stream_id, ErrorCode::REFUSED_STREAM);
+                streams.erase(stream_id);
+                return;
+            }
+
+            // A second header block is a trailer section; its fields are dropped.
+            if (!stream.headers_done) {
+                stream.headers = std::move(fields);
+                stream.headers_done = true;
+            }
+
+            if (stream.end_stream_on_headers) {
+                stream.remote_closed = true;
+                dispatch_stream(stream_id, stream);
+            }
+        }
+
+        void handle_rst_stream(const FrameHeader& header, std::string_view payload) {
+            if (header.stream_id == 0) throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "RST_STREAM on stream 0");
+            if (payload.size() != 4) throw ConnectionError(ErrorCode::FRAME_SIZE_ERROR, "Invalid RST_STREAM size");
+            if (header.stream_id > last_stream_id) {
+                throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "RST_STREAM on idle stream");
+            }
+            streams.erase(header.stream_id);
+        }
+
+        void handle_settings(const FrameHeader& header, std::string_view payload) {
+            if (header.stream_id != 0) throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "SETTINGS on stream");
+            if (header.flags & ACK) {
+                if (!payload.empty()) throw ConnectionError(ErrorCode::FRAME_SIZE_ERROR, "SETTINGS ACK with payload");
+                return;
+            }
+            if (payload.size() % 6 != 0) throw ConnectionError(ErrorCode::FRAME_SIZE_ERROR, "Invalid SETTINGS size");
+
+            settings_received = true;
+            apply_settings(payload);
+            write_frame_header(out, 0, FrameType::SETTINGS, ACK, 0);
+            flush_pending();
+        }
+
+        void apply_settings(std::string_view payload) {
+            for (size_t i = 0; i + 6 <= payload.size(); i += 6) {
+                auto id = static_cast<Setting>((static_cast<unsigned char>(payload[i]) << 8) |
+                                               static_cast<unsigned char>(payload[i + 1]));
+                uint32_t value = read_u32(payload.substr(i + 2));
+                switch (id) {
+                    case Setting::HEADER_TABLE_SIZE:
+                        encoder.set_max_table_size(value);
+                        break;
+                    case Setting::ENABLE_PUSH:
+                        if (value > 1) throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "Invalid ENABLE_PUSH");
+                        break;
+                    case Setting::INITIAL_WINDOW_SIZE: {
+                        if (value > max_window_size) {
+                            throw ConnectionError(ErrorCode::FLOW_CONTROL_ERROR, "Invalid INITIAL_WINDOW_SIZE");
+                        }
+                        int64_t delta = static_cast<int64_t>(value) - peer_initial_window_size;
+                        peer_initial_window_size = value;
+                        for (auto& [id_, stream] : streams) {
+                            stream.send_window += delta;
+                            if (stream.send_window > max_window_size) {
+                                throw ConnectionError(ErrorCode::FLOW_CONTROL_ERROR, "Window overflow");
+                            }
+                        }
+                        break;
+                    }
+                    case Setting::MAX_FRAME_SIZE:
+                        if (value < default_max_frame_size || value > 0xffffff) {
+                            throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "Invalid MAX_FRAME_SIZE");
+                        }
+                        peer_max_frame_size = value;
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+
+        void handle_ping(const FrameHeader& header, std::string_view payload) {
+            if (header.stream_id != 0) throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "PING on stream");
+            if (payload.size() != 8) throw ConnectionError(ErrorCode::FRAME_SIZE_ERROR, "Invalid PING size");
+            if (!(header.flags & ACK)) {
+                write_frame_header(out, 8, FrameType::PING, ACK, 0);
+                out += payload;
+            }
+        }
+
+        void handle_window_update(const FrameHeader& header, std::string_view payload) {
+            if (payload.size() != 4) throw ConnectionError(ErrorCode::FRAME_SIZE_ERROR, "Invalid WINDOW_UPDATE size");
+            uint32_t increment = read_u32(payload) & 0x7fffffff;
+
+            if (header.stream_id == 0) {
+                if (increment == 0) throw ConnectionError(ErrorCode::PROTOCOL_ERROR, "Zero WINDOW_UPDATE");
+                connection_send_window += increment;
+                if (connection_send_window > max_window_size) {
+                    throw ConnectionError(ErrorCode::FLOW_CONTROL_ERROR, "Connection window overflow");
+                }
+            } else {
+                auto it = streams.find(header.stream_id);
+                if (it == streams.end()) return;
+                if (increment == 0) {
+                    send_rst_stream(header.stream_id, ErrorCode::PROTOCOL_ERROR);
+                    streams.erase(it);
+                    return;
+                }
+                it->second.send_window += increment;
+                if (it->second.send_window > max_window_size) {
+                    send_rst_stream(header.stream_id, ErrorCode::FLOW_CONTROL_ERROR);
+                    streams.erase(it);
+                    return;
+                }
+            }
+            flush_pending();
+        }
+
+        // Calls the dispatcher with a Respond that ignores responses for streams
+        // the peer has reset in the meantime, or for a Session that is gone.
+        void run_dispatch(uint32_t stream_id, const Request& request) {
+            bool head_only = request.method == Method::HEAD;
+            Respond done = [this, token = std::weak_ptr<int>(alive), stream_id, head_only](Response response) {
+                if (token.expired()) return;
+                auto it = streams.find(stream_id);
+                if (it == streams.end() || it->second.response_started) return;
+                respond(stream_id, it->second, head_only, response);
+            };
+            try {
+                dispatch(request, done);
+            } catch (const std::exception& e) {
+                done(HTTP_500_INTERNAL_SERVER_ERROR(JSON::object({{"error", e.what()}})));
+            }
+        }
+
+        void dispatch_stream(uint32_t stream_id, Stream& stream) {
+            Request request(resource);
+            request.version = {2, 0};
+            bool has_method = false, has_path = false;
+            for (const auto& [name, value] : stream.headers) {
+                if (name == ":method") {
+                    request.method = string_to_method(value);
+                    has_method = true;
+                } else if (name == ":path") {
+                    request.uri = value;
+                    has_path = true;
+                } else if (name == ":authority") {
+                    request.headers.emplace("host", value);
+                } else if (!name.empty() && name[0] != ':') {
+                    auto [it, inserted] = request.headers.emplace(name, value);
+                    if (!inserted && name == "cookie") {
+                        it->second.append("; ").append(value);
+                    } else if (!inserted) {
+                        it->second.append(", ").append(value);
+                    }
+                }
+            }
+            if (!has_method || !has_path) {
+                send_rst_stream(stream_id, ErrorCode::PROTOCOL_ERROR);
+                streams.erase(stream_id);
+                return;
+            }
+
+            auto query_pos = request.uri.find('?');
+            if (query_pos != std::pmr::string::npos) {
+                request.query_params = QueryParams(std::string_view(request.uri).substr(query_pos + 1), resource);
+            }
+            request.body.assign(stream.body);
+            stream.body.clear();
+            stream.headers.clear();
+
+            run_dispatch(stream_id, request);
+        }
+
+        void respond(uint32_t stream_id, Stream& stream, bool head_only, const Response& response) {
+            std::string block;
+            encoder.begin_block(block);
+            char status[4];
+            std::to_chars(status, status + sizeof(status), static_cast<int>(response.status));
+            encoder.encode(block, ":status", std::string_view(status, 3));
+
+            std::string name;
+            for (const auto& [key, value] : response.headers) {
+                name.assign(key);
+                std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+                // Connection-specific fields are not allowed in HTTP/2 (RFC 9113 section 8.2.2).
+                if (name == "connection" || name == "keep-alive" || name == "transfer-encoding" ||
+                    name == "upgrade" || name == "proxy-connection" || name == "content-length") {
+                    continue;
+                }
+                encoder.encode(block, name, value);
+            }
+            encoder.encode(block, "content-length", std::to_string(response.body.size()), false);
+
+            bool end_stream = head_only || response.body.empty();
+            std::string_view rest(block);
+            bool first = true;
+            do {
+                std::string_view chunk = rest.substr(0, peer_max_frame_size);
+                rest.remove_prefix(chunk.size());
+                uint8_t flags = rest.empty() ? END_HEADERS : 0;
+                if (first && end_stream) flags |= END_STREAM;
+                write_frame_header(out, chunk.size(), first ? FrameType::HEADERS : FrameType::CONTINUATION, flags, stream_id);
+                out += chunk;
+                first = false;
+            } while (!rest.empty());
+
+            stream.response_started = true;
+            if (end_stream) {
+                streams.erase(stream_id);
+                return;
+            }
+            stream.pending = response.body;
+            stream.pending_offset = 0;
+            flush_pending();
+        }
+
+        // Sends queued response bodies as far as the flow-control windows allow.
+        void flush_pending() {
+            for (auto it = streams.begin(); it != streams.end() && connection_send_window > 0;) {
+                Stream& stream = it->second;
+                if (!stream.response_started) {
+                    ++it;
+                    continue;
+                }
+
+                while (stream.pending_offset < stream.pending.size() &&
+                       connection_send_window > 0 && stream.send_window > 0) {
+                    size_t remaining = stream.pending.size() - stream.pending_offset;
+                    size_t length = std::min<size_t>({remaining, peer_max_frame_size,
+                                                      static_cast<size_t>(connection_send_window),
+                                                      static_cast<size_t>(stream.send_window)});
+                    bool last = length == remaining;
+                    write_frame_header(out, length, FrameType::DATA, last ? END_STREAM : 0, it->first);
+                    out.append(stream.pending, stream.pending_offset, length);
+                    stream.pending_offset += length;
+                    connection_send_window -= length;
+                    stream.send_window -= length;
+                }
+
+                if (stream.pending_offset >= stream.pending.size()) {
+                    it = streams.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+    };
+}
+
+#endif
@@ -9,6 +9,15 @@
 #include <vector>
 #include <algorithm>
 #include <variant>
+#include <string_view>
+#include <charconv>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <type_traits>
 
 namespace http {
 
@@ -16,15 +25,33 @@ namespace http {
     public:
         using Object = std::map<std::string, JSON>;
         using Array = std::vector<JSON>;
-        using Value = std::variant<std::nullptr_t, bool, int, double, std::string, Array, Object>;
+        // Integers that fit in int are stored as int; larger ones as int64_t, or
+        // uint64_t above INT64_MAX.
+        using Value = std::variant<std::nullptr_t, bool, int, int64_t, uint64_t, double, std::string, Array, Object>;
 
         JSON() : m_value(nullptr) {}
         JSON(std::nullptr_t) : m_value(nullptr) {}
         JSON(bool value) : m_value(value) {}
         JSON(int value) : m_value(value) {}
         JSON(double value) : m_value(value) {}
+
+        template<typename T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool> &&
+                                              !std::is_same_v<T, int>, int> = 0>
+        JSON(T value) {
+            if constexpr (sizeof(T) < sizeof(int) || (std::is_signed_v<T> && sizeof(T) == sizeof(int))) {
+                m_value = static_cast<int>(value);
+            } else if constexpr (std::is_signed_v<T>) {
+                m_value = static_cast<int64_t>(value);
+            } else {
+                m_value = static_cast<uint64_t>(value);
+            }
+        }
+
         JSON(const char* value) : m_value(std::string(value)) {}
         JSON(const std::string& value) : m_value(value) {}
+        // Strings with other allocators, e.g. std::pmr::string route parameters.
+        template<typename Alloc>
+        JSON(const std::basic_string<char, std::char_traits<char>, Alloc>& value) : m_value(std::string(value)) {}
         JSON(const Array& value) : m_value(value) {}
         JSON(const Object& value) : m_value(value) {}
 
@@ -36,7 +63,7 @@ namespace http {
             return JSON(Array(init.begin(), init.end()));
         }
 
-        static JSON parse(const std::string& json_string) {
+        static JSON parse(std::string_view json_string) {
             size_t index = 0;
             return parse_value(json_string, index);
         }
@@ -51,36 +78,56 @@ namespace http {
         const Value& get_value() const { return m_value; }
 
         std::string stringify() const {
-            return std::visit([](auto&& arg) -> std::string {
+            std::string result;
+            stringify_to(result);
+            return result;
+        }
+
+        // Appends the serialized value to out, so nested values share one buffer.
+        void stringify_to(std::string& out) const {
+            std::visit([&out](auto&& arg) {
                 using T = std::decay_t<decltype(arg)>;
                 if constexpr (std::is_same_v<T, std::nullptr_t>) {
-                    return "null";
+                    out += "null";
                 } else if constexpr (std::is_same_v<T, bool>) {
-                    return arg ? "true" : "false";
-                } else if constexpr (std::is_same_v<T, int>) {
-                    return std::to_string(arg);
+                    out += arg ? "true" : "false";
+                } else if constexpr (std::is_same_v<T, int> || std::is_same_v<T, int64_t> || std::is_same_v<T, uint64_t>) {
+                    char buffer[24];
+                    auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), arg);
+                    out.append(buffer, end);
                 } else if constexpr (std::is_same_v<T, double>) {
-                    return std::to_string(arg);
+                    // Shortest text that parses back to the same double; JSON has
+                    // no NaN or infinity.
+                    if (!std::isfinite(arg)) {
+                        out += "null";
+                    } else {
+                        char buffer[32];
+                        auto [end, ec] = std::to_chars(buffer, buffer + sizeof(buffer), arg);
+                        out.append(buffer, end);
+                    }
                 } else if constexpr (std::is_same_v<T, std::string>) {
-                    return "\"" + escape_string(arg) + "\"";
+                    out += '"';
+                    escape_string_to(arg, out);
+                    out += '"';
                 } else if constexpr (std::is_same_v<T, Array>) {
-                    std::string result = "[";
+                    out += '[';
                     for (size_t i = 0; i < arg.size(); ++i) {
-                        if (i > 0) result += ",";
-                        result += arg[i].stringify();
+                        if (i > 0) out += ',';
+                        arg[i].stringify_to(out);
                     }
-                    result += "]";
-                    return result;
+                    out += ']';
                 } else if constexpr (std::is_same_v<T, Object>) {
-                    std::string result = "{";
+                    out += '{';
                     bool first = true;
                     for (const auto& [key, value] : arg) {
-                        if (!first) result += ",";
-                        result += "\"" + escape_string(key) + "\":" + value.stringify();
+                        if (!first) out += ',';
+                        out += '"';
+                        escape_string_to(key, out);
+                        out += "\":";
+                        value.stringify_to(out);
                         first = false;
                     }
-                    result += "}";
-                    return result;
+                    out += '}';
                 }
             }, m_value);
         }
@@ -93,32 +140,68 @@ namespace http {
             return std::get<std::string>(m_value);
         }
 
+        bool is_number() const {
+            return std::holds_alternative<int>(m_value) || std::holds_alternative<int64_t>(m_value) ||
+                   std::holds_alternative<uint64_t>(m_value) || std::holds_alternative<double>(m_value);
+        }
+
+        int64_t as_int64() const {
+            if (auto value = std::get_if<int>(&m_value)) return *value;
+            if (auto value = std::get_if<int64_t>(&m_value)) return *value;
+            if (auto value = std::get_if<uint64_t>(&m_value)) {
+                if (*value > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) {
+                    throw std::runtime_error("JSON integer out of int64 range");
+                }
+                return static_cast<int64_t>(*value);
+            }
+            throw std::runtime_error("JSON value is not an integer");
+        }
+
+        uint64_t as_uint64() const {
+            if (auto value = std::get_if<uint64_t>(&m_value)) return *value;
+            int64_t value = as_int64();
+            if (value < 0) {
+                throw std::runtime_error("JSON integer is negative");
+            }
+            return static_cast<uint64_t>(value);
+        }
+
+        double as_double() const {
+            if (auto value = std::get_if<double>(&m_value)) return *value;
+            if (auto value = std::get_if<uint64_t>(&m_value)) return static_cast<double>(*value);
+            if (!is_number()) {
+                throw std::runtime_error("JSON value is not a number");
+            }
+            return static_cast<double>(as_int64());
+        }
+
     private:
         Value m_value;
 
-        static std::string escape_string(const std::string& s) {
-            std::string result;
+        static void escape_string_to(const std::string& s, std::string& out) {
+            static constexpr char hex_digits[] = "0123456789abcdef";
             for (char c : s) {
                 switch (c) {
-                    case '"': result += "\\\""; break;
-                    case '\\': result += "\\\\"; break;
-                    case '\b': result += "\\b"; break;
-                    case '\f': result += "\\f"; break;
-                    case '\n': result += "\\n"; break;
-                    case '\r': result += "\\r"; break;
-                    case '\t': result += "\\t"; break;
+                    case '"': out += "\\\""; break;
+                    case '\\': out += "\\\\"; break;
+                    case '\b': out += "\\b"; break;
+                    case '\f': out += "\\f"; break;
+                    case '\n': out += "\\n"; break;
+                    case '\r': out += "\\r"; break;
+                    case '\t': out += "\\t"; break;
                     default:
                         if ('\x00' <= c && c <= '\x1f') {
-                            result += "\\u" + std::string(4 - std::to_string((int)c).length(), '0') + std::to_string((int)c);
+                            out += "\\u00";
+                            out += hex_digits[(c >> 4) & 0xF];
+                            out += hex_digits[c & 0xF];
                         } else {
-                            result += c;
+                            out += c;
                         }
                 }
             }
-            return result;
         }
 
-        static JSON parse_value(const std::string& json_string, size_t& index) {
+        static JSON parse_value(std::string_view json_string, size_t& index) {
             skip_whitespace(json_string, index);
 
             if (index >= json_string.length()) {
@@ -143,7 +226,7 @@ namespace http {
             throw std::runtime_error("Unexpected character");
         }
 
-        static JSON parse_object(const std::string& json_string, size_t& index) {
+        static JSON parse_object(std::string_view json_string, size_t& index) {
             Object obj;
             index++;
 
@@ -182,7 +265,7 @@ namespace http {
             throw std::runtime_error("Unterminated object");
         }
 
-        static JSON parse_array(const std::string& json_string, size_t& index) {
+        static JSON parse_array(std::string_view json_string, size_t& index) {
             Array arr;
             index++;
 
@@ -206,7 +289,7 @@ namespace http {
             throw std::runtime_error("Unterminated array");
         }
 
-        static JSON parse_string(const std::string& json_string, size_t& index) {
+        static JSON parse_string(std::string_view json_string, size_t& index) {
             index++;
             std::string result;
             while (index < json_string.length()) {
@@ -228,13 +311,18 @@ namespace http {
                         case 'r': result += '\r'; break;
                         case 't': result += '\t'; break;
                         case 'u': {
-                            if (index + 4 > json_string.length()) {
-                                throw std::runtime_error("Incomplete Unicode escape");
+                            uint32_t codepoint = parse_hex4(json_string, index);
+                            // A high surrogate must be followed by an escaped low surrogate.
+                            if (codepoint >= 0xD800 && codepoint <= 0xDBFF &&
+                                json_string.substr(index, 2) == "\\u") {
+                                size_t low_index = index + 2;
+                                uint32_t low = parse_hex4(json_string, low_index);
+                                if (low >= 0xDC00 && low <= 0xDFFF) {
+                                    codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                                    index = low_index;
+                                }
                             }
-                            std::string hex = json_string.substr(index, 4);
-                            index += 4;
-                            int codepoint = std::stoi(hex, nullptr, 16);
-                            result += static_cast<char>(codepoint);
+                            append_utf8(result, codepoint);
                             break;
                         }
                         default:
@@ -247,7 +335,7 @@ namespace http {
             throw std::runtime_error("Unterminated string");
         }
 
-        static JSON parse_boolean(const std::string& json_string, size_t& index) {
+        static JSON parse_boolean(std::string_view json_string, size_t& index) {
             if (json_string.substr(index, 4) == "true") {
                 index += 4;
                 return JSON(true);
@@ -258,7 +346,7 @@ namespace http {
             throw std::runtime_error("Invalid boolean value");
         }
 
-        static JSON parse_null(const std::string& json_string, size_t& index) {
+        static JSON parse_null(std::string_view json_string, size_t& index) {
             if (json_string.substr(index, 4) == "null") {
                 index += 4;
                 return JSON(nullptr);
@@ -266,7 +354,7 @@ namespace http {
             throw std::runtime_error("Invalid null value");
         }
 
-        static JSON parse_number(const std::string& json_string, size_t& index) {
+        static JSON parse_number(std::string_view json_string, size_t& index) {
             size_t start = index;
             bool is_float = false;
             while (index < json_string.length()) {
@@ -280,15 +368,71 @@ namespace http {
                     break;
                 }
             }
-            std::string num_str = json_string.substr(start, index - start);
-            if (is_float) {
-                return JSON(std::stod(num_str));
+            return number_from_chars(json_string.substr(start, index - start), is_float);
+        }
+
+    public:
+        // Converts the text of a JSON number to the narrowest alternative that
+        // holds it exactly: int, int64_t, uint64_t, else double.
+        static JSON number_from_chars(std::string_view text, bool is_float) {
+            const char* first = text.data();
+            const char* last = text.data() + text.size();
+            if (!is_float) {
+                int64_t value;
+                auto [end, ec] = std::from_chars(first, last, value);
+                if (ec == std::errc() && end == last) {
+                    if (value >= std::numeric_limits<int>::min() && value <= std::numeric_limits<int>::max()) {
+                        return JSON(static_cast<int>(value));
+                    }
+                    return JSON(value);
+                }
+                uint64_t unsigned_value;
+                auto [unsigned_end, unsigned_ec] = std::from_chars(first, last, unsigned_value);
+                if (unsigned_ec == std::errc() && unsigned_end == last) {
+                    return JSON(unsigned_value);
+                }
+            }
+            double value;
+            auto [end, ec] = std::from_chars(first, last, value);
+            if (ec != std::errc() || end != last) {
+                throw std::runtime_error("Invalid number");
+            }
+            return JSON(value);
+        }
+
+    private:
+        static uint32_t parse_hex4(std::string_view json_string, size_t& index) {
+            if (index + 4 > json_string.length()) {
+                throw std::runtime_error("Incomplete Unicode escape");
+            }
+            uint32_t value = 0;
+            auto [end, ec] = std::from_chars(json_string.data() + index, json_string.data() + index + 4, value, 16);
+            if (ec != std::errc() || end != json_string.data() + index + 4) {
+                throw std::runtime_error("Invalid Unicode escape");
+            }
+            index += 4;
+            return value;
+        }
+
+        static void append_utf8(std::string& out, uint32_t codepoint) {
+            if (codepoint < 0x80) {
+                out += static_cast<char>(codepoint);
+            } else if (codepoint < 0x800) {
+                out += static_cast<char>(0xC0 | (codepoint >> 6));
+                out += static_cast<char>(0x80 | (codepoint & 0x3F));
+            } else if (codepoint < 0x10000) {
+                out += static_cast<char>(0xE0 | (codepoint >> 12));
+                out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (codepoint & 0x3F));
             } else {
-                return JSON(std::stoi(num_str));
+                out += static_cast<char>(0xF0 | (codepoint >> 18));
+                out += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+                out += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (codepoint & 0x3F));
             }
         }
 
-        static void skip_whitespace(const std::string& json_string, size_t& index) {
+        static void skip_whitespace(std::string_view json_string, size_t& index) {
             while (index < json_string.length() && std::isspace(json_string[index])) {
                 index++;
             }
@@ -313,15 +457,18 @@ namespace http {
         CREATED = 201,
         ACCEPTED = 202,
         NO_CONTENT = 204,
+        NOT_MODIFIED = 304,
         BAD_REQUEST = 400,
         UNAUTHORIZED = 401,
         FORBIDDEN = 403,
         NOT_FOUND = 404,
         METHOD_NOT_ALLOWED = 405,
+        REQUEST_TIMEOUT = 408,
         INTERNAL_SERVER_ERROR = 500,
         NOT_IMPLEMENTED = 501,
         BAD_GATEWAY = 502,
-        SERVICE_UNAVAILABLE = 503
+        SERVICE_UNAVAILABLE = 503,
+        GATEWAY_TIMEOUT = 504
     };
 
     struct Version {
@@ -329,107 +476,378 @@ namespace http {
         int minor;
     };
 
-    class QueryParams {
-    public:
-        explicit QueryParams(const std::string& query_string) {
-            parse_query_string(query_string);
+    inline int hex_value(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+
+    // Decodes "%xx" escapes and '+' as space, appending to result. Malformed
+    // escapes are kept verbatim.
+    template<typename String>
+    inline void url_decode_to(std::string_view encoded, String& result) {
+        result.reserve(result.size() + encoded.size());
+        for (size_t i = 0; i < encoded.size(); ++i) {
+            char c = encoded[i];
+            if (c == '+') {
+                result += ' ';
+            } else if (c == '%' && i + 2 < encoded.size() && hex_value(encoded[i + 1]) >= 0 && hex_value(encoded[i + 2]) >= 0) {
+                result += static_cast<char>(hex_value(encoded[i + 1]) * 16 + hex_value(encoded[i + 2]));
+                i += 2;
+            } else {
+                result += c;
+            }
         }
+    }
 
-        std::string get(const std::string& key) const {
-            auto it = params_.find(key);
-            return (it != params_.end()) ? it->second : "";
+    inline std::string url_decode(std::string_view encoded) {
+        std::string result;
+        url_decode_to(encoded, result);
+        return result;
+    }
+
+    inline std::pmr::string url_decode(std::string_view encoded, std::pmr::memory_resource* resource) {
+        std::pmr::string result(resource);
+        url_decode_to(encoded, result);
+        return result;
+    }
+
+    inline bool needs_url_decode(std::string_view encoded) {
+        return encoded.find_first_of("%+") != std::string_view::npos;
+    }
+
+    // Zero-copy view over application/x-www-form-urlencoded data (query strings
+    // and form bodies). The text is split into key/value views on first access
+    // only; values are percent-decoded on demand. The viewed text must outlive
+    // the view.
+    class FormView {
+    public:
+        struct Entry {
+            std::string_view key;
+            std::string_view value;
+        };
+
+        explicit FormView(std::string_view encoded = {},
+                          std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+                : encoded_(encoded), entries_(resource) {}
+
+        std::string_view raw() const { return encoded_; }
+
+        bool empty() const { return encoded_.empty(); }
+
+        // Returns the still-encoded value of the first occurrence of key, or "" if missing.
+        std::string_view get_raw(std::string_view key) const {
+            const Entry* entry = find(key);
+            return entry ? entry->value : std::string_view();
         }
 
-        bool has(const std::string& key) const {
-            return params_.find(key) != params_.end();
+        // Returns the decoded value of the first occurrence of key, or "" if missing.
+        std::string get(std::string_view key) const {
+            const Entry* entry = find(key);
+            return entry ? url_decode(entry->value) : std::string();
         }
 
-        int get_int(const std::string& key) const {
-            try {
-                return std::stoi(get(key));
-            } catch (const std::exception&) {
-                return 0;
+        // Returns the decoded values of every occurrence of key, in order.
+        std::vector<std::string> get_list(std::string_view key) const {
+            std::vector<std::string> values;
+            for (const auto& entry : entries()) {
+                if (key_equals(entry.key, key)) {
+                    values.push_back(url_decode(entry.value));
+                }
             }
+            return values;
         }
 
-        double get_double(const std::string& key) const {
-            try {
-                return std::stod(get(key));
-            } catch (const std::exception&) {
-                return 0.0;
-            }
+        bool has(std::string_view key) const {
+            return find(key) != nullptr;
+        }
+
+        int get_int(std::string_view key, int fallback = 0) const {
+            return get_number<int>(key, fallback);
+        }
+
+        long long get_int64(std::string_view key, long long fallback = 0) const {
+            return get_number<long long>(key, fallback);
         }
 
-        bool get_bool(const std::string& key) const {
+        double get_double(std::string_view key, double fallback = 0.0) const {
+            return get_number<double>(key, fallback);
+        }
+
+        bool get_bool(std::string_view key) const {
             std::string value = get(key);
             std::transform(value.begin(), value.end(), value.begin(), ::tolower);
             return value == "true" || value == "1" || value == "yes";
         }
 
-        std::string get_string(const std::string& key) const {
+        std::string get_string(std::string_view key) const {
             return get(key);
         }
 
-        const std::map<std::string, std::string>& get_all() const {
-            return params_;
+        // Raw (still encoded) key/value views, parsed at most once.
+        const std::pmr::vector<Entry>& entries() const {
+            if (!parsed_) {
+                parse();
+            }
+            return entries_;
+        }
+
+        // Decoded snapshot of all parameters. Repeated keys keep the first value.
+        std::map<std::string, std::string> get_all() const {
+            std::map<std::string, std::string> params;
+            for (const auto& entry : entries()) {
+                params.emplace(url_decode(entry.key), url_decode(entry.value));
+            }
+            return params;
+        }
+
+    protected:
+        // Points the view at new text and drops the cached split.
+        void rebind(std::string_view encoded) {
+            encoded_ = encoded;
+            entries_.clear();
+            parsed_ = false;
         }
 
     private:
-        std::map<std::string, std::string> params_;
-
-        void parse_query_string(const std::string& query_string) {
-            auto pairs = split(query_string, '&');
-            for (const auto& pair : pairs) {
-                auto kv = split(pair, '=');
-                if (kv.size() == 2) {
-                    params_[kv[0]] = kv[1];
-                } else if (kv.size() == 1) {
-                    params_[kv[0]] = "";
+        std::string_view encoded_;
+        mutable std::pmr::vector<Entry> entries_;
+        mutable bool parsed_ = false;
+
+        void parse() const {
+            std::string_view query(encoded_);
+            while (!query.empty()) {
+                auto amp_pos = query.find('&');
+                std::string_view pair = query.substr(0, amp_pos);
+                query = (amp_pos == std::string_view::npos) ? std::string_view() : query.substr(amp_pos + 1);
+                if (pair.empty()) continue;
+
+                auto eq_pos = pair.find('=');
+                if (eq_pos == std::string_view::npos) {
+                    entries_.push_back({pair, std::string_view()});
+                } else {
+                    entries_.push_back({pair.substr(0, eq_pos), pair.substr(eq_pos + 1)});
+                }
+            }
+            parsed_ = true;
+        }
+
+        static bool key_equals(std::string_view encoded_key, std::string_view key) {
+            return needs_url_decode(encoded_key) ? url_decode(encoded_key) == key : encoded_key == key;
+        }
+
+        const Entry* find(std::string_view key) const {
+            for (const auto& entry : entries()) {
+                if (key_equals(entry.key, key)) {
+                    return &entry;
                 }
             }
+            return nullptr;
         }
 
-        std::vector<std::string> split(const std::string& str, char delim) {
-            std::vector<std::string> tokens;
-            std::string token;
-            std::istringstream tokenStream(str);
-            while (std::getline(tokenStream, token, delim)) {
-                tokens.push_back(token);
+        template<typename T>
+        T get_number(std::string_view key, T fallback) const {
+            const Entry* entry = find(key);
+            if (!entry) return fallback;
+
+            std::string decoded;
+            std::string_view text = entry->value;
+            if (needs_url_decode(text)) {
+                decoded = url_decode(text);
+                text = decoded;
+            }
+
+            T value{};
+            auto [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+            if (ec != std::errc() || ptr != text.data() + text.size()) {
+                return fallback;
             }
-            return tokens;
+            return value;
+        }
+    };
+
+    // Query string of a request. Owns its text and exposes it through FormView.
+    class QueryParams : public FormView {
+    public:
+        explicit QueryParams(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+                : FormView({}, resource), raw_(resource) {}
+
+        explicit QueryParams(std::string_view query_string,
+                             std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+                : FormView({}, resource), raw_(query_string, resource) {
+            rebind(raw_);
+        }
+
+        QueryParams(const QueryParams& other) : FormView(), raw_(other.raw_) {
+            rebind(raw_);
+        }
+
+        QueryParams(QueryParams&& other) noexcept
+                : FormView({}, other.raw_.get_allocator().resource()), raw_(std::move(other.raw_)) {
+            rebind(raw_);
+            other.rebind(other.raw_);
+        }
+
+        QueryParams& operator=(const QueryParams& other) {
+            if (this != &other) {
+                raw_ = other.raw_;
+                rebind(raw_);
+            }
+            return *this;
+        }
+
+        QueryParams& operator=(QueryParams&& other) noexcept {
+            raw_ = std::move(other.raw_);
+            rebind(raw_);
+            other.rebind(other.raw_);
+            return *this;
         }
+
+    private:
+        std::pmr::string raw_;
+    };
+
+    // Monotonic arena backing one connection's requests. Everything drawn from
+    // it is freed at once by reset(); the initial block is kept, so requests
+    // that fit in it never reach the global allocator.
+    class Arena {
+    public:
+        explicit Arena(size_t initial_size = 64 * 1024)
+                : buffer_(std::make_unique<std::byte[]>(initial_size)),
+                  resource_(buffer_.get(), initial_size) {}
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        std::pmr::memory_resource* resource() { return &resource_; }
+
+        void reset() { resource_.release(); }
+
+    private:
+        std::unique_ptr<std::byte[]> buffer_;
+        std::pmr::monotonic_buffer_resource resource_;
     };
 
+    // Header names are case-insensitive (RFC 9110 section 5.1); HTTP/2 sends them lowercased.
+    struct CaseInsensitiveLess {
+        using is_transparent = void;
+
+        bool operator()(std::string_view a, std::string_view b) const {
+            return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), [](char x, char y) {
+                return std::tolower(static_cast<unsigned char>(x)) < std::tolower(static_cast<unsigned char>(y));
+            });
+        }
+    };
+
+    inline bool iequals(std::string_view a, std::string_view b) {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+            return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+        });
+    }
+
+    // True if the comma-separated header value contains token (case-insensitive).
+    inline bool header_has_token(std::string_view value, std::string_view token) {
+        while (!value.empty()) {
+            auto comma = value.find(',');
+            std::string_view item = value.substr(0, comma);
+            while (!item.empty() && std::isspace(static_cast<unsigned char>(item.front()))) item.remove_prefix(1);
+            while (!item.empty() && std::isspace(static_cast<unsigned char>(item.back()))) item.remove_suffix(1);
+            if (iequals(item, token)) return true;
+            value = (comma == std::string_view::npos) ? std::string_view() : value.substr(comma + 1);
+        }
+        return false;
+    }
+
+    inline std::string base64_encode(std::string_view input) {
+        static constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        std::string result;
+        result.reserve((input.size() + 2) / 3 * 4);
+        size_t i = 0;
+        for (; i + 3 <= input.size(); i += 3) {
+            uint32_t n = (static_cast<unsigned char>(input[i]) << 16) |
+                         (static_cast<unsigned char>(input[i + 1]) << 8) |
+                         static_cast<unsigned char>(input[i + 2]);
+            result += alphabet[(n >> 18) & 63];
+            result += alphabet[(n >> 12) & 63];
+            result += alphabet[(n >> 6) & 63];
+            result += alphabet[n & 63];
+        }
+        if (i < input.size()) {
+            uint32_t n = static_cast<unsigned char>(input[i]) << 16;
+            if (i + 1 < input.size()) n |= static_cast<unsigned char>(input[i + 1]) << 8;
+            result += alphabet[(n >> 18) & 63];
+            result += alphabet[(n >> 12) & 63];
+            result += (i + 1 < input.size()) ? alphabet[(n >> 6) & 63] : '=';
+            result += '=';
+        }
+        return result;
+    }
+
+    // Accepts both the standard and URL-safe alphabets, with or without padding.
+    inline std::string base64_decode(std::string_view input) {
+        std::string result;
+        result.reserve(input.size() * 3 / 4);
+        uint32_t buffer = 0;
+        int bits = 0;
+        for (char c : input) {
+            int value;
+            if (c >= 'A' && c <= 'Z') value = c - 'A';
+            else if (c >= 'a' && c <= 'z') value = c - 'a' + 26;
+            else if (c >= '0' && c <= '9') value = c - '0' + 52;
+            else if (c == '+' || c == '-') value = 62;
+            else if (c == '/' || c == '_') value = 63;
+            else if (c == '=') break;
+            else throw std::runtime_error("Invalid base64 character");
+
+            buffer = (buffer << 6) | value;
+            bits += 6;
+            if (bits >= 8) {
+                bits -= 8;
+                result += static_cast<char>((buffer >> bits) & 0xff);
+            }
+        }
+        return result;
+    }
+
+    using Headers = std::pmr::map<std::pmr::string, std::pmr::string, CaseInsensitiveLess>;
+
     struct Request {
         Method method;
-        std::string uri;
+        std::pmr::string uri;
         Version version;
-        std::map<std::string, std::string> headers;
-        std::string body;
+        Headers headers;
+        std::pmr::string body;
         QueryParams query_params;
 
-        Request() : method(Method::GET), version({1, 1}), query_params("") {}
+        explicit Request(std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+                : method(Method::GET), uri(resource), version({1, 1}), headers(resource), body(resource),
+                  query_params(resource) {}
 
         Request(Method m, const std::string& u, Version v,
                 const std::map<std::string, std::string>& h,
                 const std::string& b)
-                : method(m), version(v), headers(h), body(b), query_params("")
+                : method(m), version(v), headers(h.begin(), h.end()), body(b)
         {
             size_t query_start = u.find('?');
             if (query_start != std::string::npos) {
                 uri = u.substr(0, query_start);
-                query_params = QueryParams(u.substr(query_start + 1));
+                query_params = QueryParams(std::string_view(u).substr(query_start + 1));
             } else {
                 uri = u;
             }
         }
 
-        std::string get_header(const std::string& key) const {
+        std::pmr::memory_resource* resource() const {
+            return headers.get_allocator().resource();
+        }
+
+        std::string get_header(std::string_view key) const {
             auto it = headers.find(key);
-            return (it != headers.end()) ? it->second : "";
+            return (it != headers.end()) ? std::string(it->second) : "";
         }
 
-        bool has_header(const std::string& key) const {
+        bool has_header(std::string_view key) const {
             return headers.find(key) != headers.end();
         }
     };
@@ -440,26 +858,38 @@ namespace http {
         std::map<std::string, std::string> headers;
         std::string body;
 
-        std::string status_message() const {
+        const char* status_message() const {
             switch (status) {
                 case HttpStatus::OK: return "OK";
                 case HttpStatus::CREATED: return "Created";
                 case HttpStatus::ACCEPTED: return "Accepted";
                 case HttpStatus::NO_CONTENT: return "No Content";
+                case HttpStatus::NOT_MODIFIED: return "Not Modified";
                 case HttpStatus::BAD_REQUEST: return "Bad Request";
                 case HttpStatus::UNAUTHORIZED: return "Unauthorized";
                 case HttpStatus::FORBIDDEN: return "Forbidden";
                 case HttpStatus::NOT_FOUND: return "Not Found";
                 case HttpStatus::METHOD_NOT_ALLOWED: return "Method Not Allowed";
+                case HttpStatus::REQUEST_TIMEOUT: return "Request Timeout";
                 case HttpStatus::INTERNAL_SERVER_ERROR: return "Internal Server Error";
                 case HttpStatus::NOT_IMPLEMENTED: return "Not Implemented";
                 case HttpStatus::BAD_GATEWAY: return "Bad Gateway";
                 case HttpStatus::SERVICE_UNAVAILABLE: return "Service Unavailable";
+                case HttpStatus::GATEWAY_TIMEOUT: return "Gateway Timeout";
                 default: return "Unknown Status";
             }
         }
     };
 
+    // Case-insensitive lookup in Response headers, which keep the caller's spelling.
+    inline std::map<std::string, std::string>::const_iterator find_header(const std::map<std::string, std::string>& headers,
+                                                                           std::string_view name) {
+        for (auto it = headers.begin(); it != headers.end(); ++it) {
+            if (iequals(it->first, name)) return it;
+        }
+        return headers.end();
+    }
+
     inline std::string trim(const std::string& str) {
         auto start = std::find_if_not(str.begin(), str.end(), ::isspace);
         auto end = std::find_if_not(str.rbegin(), str.rend(), ::isspace).base();
@@ -505,46 +935,150 @@ namespace http {
         }
     }
 
-    inline Request parse_request(const std::string& raw_request) {
-        Request request;
-        std::istringstream stream(raw_request);
-        std::string line;
+    inline std::string_view trim_view(std::string_view str) {
+        while (!str.empty() && std::isspace(static_cast<unsigned char>(str.front()))) str.remove_prefix(1);
+        while (!str.empty() && std::isspace(static_cast<unsigned char>(str.back()))) str.remove_suffix(1);
+        return str;
+    }
+
+    // Splits off the text up to delim (or "\n" for lines) and advances input past it.
+    inline std::string_view next_token(std::string_view& input, char delim) {
+        auto pos = input.find(delim);
+        std::string_view token = input.substr(0, pos);
+        input = (pos == std::string_view::npos) ? std::string_view() : input.substr(pos + 1);
+        return token;
+    }
 
-        std::getline(stream, line);
-        auto parts = split(line, ' ');
-        if (parts.size() >= 3) {
-            request.method = string_to_method(parts[0]);
-            request.uri = parts[1];
-            auto version_parts = split(parts[2].substr(5), '.');
-            request.version = {std::stoi(version_parts[0]), std::stoi(version_parts[1])};
+    inline Request parse_request(std::string_view raw_request,
+                                 std::pmr::memory_resource* resource = std::pmr::get_default_resource()) {
+        Request request(resource);
+        std::string_view rest = raw_request;
+
+        std::string_view line = next_token(rest, '\n');
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+
+        std::string_view method = next_token(line, ' ');
+        std::string_view uri = next_token(line, ' ');
+        std::string_view version = line;
+        if (!version.empty() && version.substr(0, 5) == "HTTP/") {
+            request.method = string_to_method(std::string(method));
+            request.uri = uri;
+            auto query_pos = uri.find('?');
+            if (query_pos != std::string_view::npos) {
+                request.query_params = QueryParams(uri.substr(query_pos + 1), resource);
+            }
+
+            version.remove_prefix(5);
+            std::string_view major = next_token(version, '.');
+            std::from_chars(major.data(), major.data() + major.size(), request.version.major);
+            std::from_chars(version.data(), version.data() + version.size(), request.version.minor);
         }
 
-        while (std::getline(stream, line) && line != "\r") {
+        while (!rest.empty()) {
+            line = next_token(rest, '\n');
+            if (line == "\r" || line.empty()) break;
+
             auto colon_pos = line.find(':');
-            if (colon_pos != std::string::npos) {
-                auto key = trim(line.substr(0, colon_pos));
-                auto value = trim(line.substr(colon_pos + 1));
-                request.headers[key] = value;
+            if (colon_pos != std::string_view::npos) {
+                auto key = trim_view(line.substr(0, colon_pos));
+                auto value = trim_view(line.substr(colon_pos + 1));
+                auto [it, inserted] = request.headers.emplace(key, value);
+                if (!inserted) {
+                    // Repeated fields combine into one comma-separated list (RFC 9110 section 5.3).
+                    it->second += ", ";
+                    it->second += value;
+                }
             }
         }
 
-        std::string body((std::istreambuf_iterator<char>(stream)), std::istreambuf_iterator<char>());
-        request.body = body;
+        request.body.assign(rest);
 
         return request;
     }
 
-    inline std::string construct_response(const Response& response) {
-        std::ostringstream stream;
-        stream << "HTTP/" << response.version.major << "." << response.version.minor << " "
-               << static_cast<int>(response.status) << " " << response.status_message() << "\r\n";
+    // Appends the serialized response to out, e.g. a connection's output buffer.
+    template<typename String>
+    inline void construct_response_to(const Response& response, String& out) {
+        std::string_view status_message = response.status_message();
+        size_t size = 32 + status_message.size() + response.body.size();
+        for (const auto& header : response.headers) {
+            size += header.first.size() + header.second.size() + 4;
+        }
+        out.reserve(out.size() + size);
+
+        char number[16];
+        out += "HTTP/";
+        out.append(number, std::to_chars(number, number + sizeof(number), response.version.major).ptr);
+        out += '.';
+        out.append(number, std::to_chars(number, number + sizeof(number), response.version.minor).ptr);
+        out += ' ';
+        out.append(number, std::to_chars(number, number + sizeof(number), static_cast<int>(response.status)).ptr);
+        out += ' ';
+        out += status_message;
+        out += "\r\n";
 
         for (const auto& header : response.headers) {
-            stream << header.first << ": " << header.second << "\r\n";
+            out += header.first;
+            out += ": ";
+            out += header.second;
+            out += "\r\n";
+        }
+
+        out += "\r\n";
+        out += response.body;
+    }
+
+    inline std::pmr::string construct_response(const Response& response,
+                                               std::pmr::memory_resource* resource = std::pmr::get_default_resource()) {
+        std::pmr::string out(resource);
+        construct_response_to(response, out);
+        return out;
+    }
+
+    // Serializes an outgoing request for host. The request target is uri plus
+    // the query string; Content-Length is added for bodies that lack one.
+    inline std::string construct_request(const Request& request, std::string_view host) {
+        std::string_view query = request.query_params.raw();
+        std::string method = method_to_string(request.method);
+        size_t size = 32 + method.size() + request.uri.size() + query.size() + host.size() + request.body.size();
+        for (const auto& header : request.headers) {
+            size += header.first.size() + header.second.size() + 4;
+        }
+
+        std::string out;
+        out.reserve(size);
+        out += method;
+        out += ' ';
+        out += request.uri.empty() ? "/" : std::string_view(request.uri);
+        if (!query.empty()) {
+            out += '?';
+            out += query;
+        }
+        out += " HTTP/1.1\r\n";
+
+        if (!request.has_header("Host")) {
+            out += "Host: ";
+            out += host;
+            out += "\r\n";
+        }
+        for (const auto& header : request.headers) {
+            out += header.first;
+            out += ": ";
+            out += header.second;
+            out += "\r\n";
+        }
+        if (!request.has_header("Content-Length") &&
+            (!request.body.empty() || request.method == Method::POST || request.method == Method::PUT ||
+             request.method == Method::PATCH)) {
+            char number[24];
+            out += "Content-Length: ";
+            out.append(number, std::to_chars(number, number + sizeof(number), request.body.size()).ptr);
+            out += "\r\n";
         }
 
-        stream << "\r\n" << response.body;
-        return stream.str();
+        out += "\r\n";
+        out += request.body;
+        return out;
     }
 
     inline Response HTTP_200_OK(const JSON& body = JSON(), std::map<std::string, std::string> headers = {{"Content-Type", "application/json"}}) {
@@ -0,0 +1,334 @@
+// Tomas Costantino
+
+#ifndef JSON_CURSOR_H
+#define JSON_CURSOR_H
+
+#include "http_lib.h"
+#include <string>
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+
+namespace http {
+
+    // On-demand access to fields of a JSON text without building a JSON tree:
+    //
+    //     http::JSONCursor doc(request.body);
+    //     int64_t id = doc["user"]["id"].get_int64();
+    //
+    // A cursor is a view positioned at one value. Indexing scans the enclosing
+    // object or array and steps over the values it passes with a bracket-matching
+    // skip, so only the path to the requested field is parsed. Skipped subtrees
+    // are not validated. A cursor does not own its text; the text must outlive
+    // every cursor taken from it.
+    class JSONCursor {
+    public:
+        enum class Type {
+            MISSING,
+            NULL_VALUE,
+            BOOLEAN,
+            NUMBER,
+            STRING,
+            ARRAY,
+            OBJECT
+        };
+
+        JSONCursor() = default;
+
+        explicit JSONCursor(std::string_view text) : text(text) {
+            size_t index = skip_whitespace(this->text, 0);
+            this->text.remove_prefix(index);
+        }
+
+        // The member named key, or a missing cursor if there is none. Indexing a
+        // missing cursor yields another missing cursor, so chains only fail when
+        // a value is read.
+        JSONCursor operator[](std::string_view key) const {
+            if (!exists()) return {};
+            if (text[0] != '{') {
+                throw std::runtime_error("JSON value is not an object");
+            }
+            JSONCursor result;
+            visit_members([&](std::string_view raw_key, const JSONCursor& value) {
+                if (key_equals(raw_key, key)) {
+                    result = value;
+                    return false;
+                }
+                return true;
+            });
+            return result;
+        }
+
+        JSONCursor operator[](size_t index) const {
+            if (!exists()) return {};
+            if (text[0] != '[') {
+                throw std::runtime_error("JSON value is not an array");
+            }
+            JSONCursor result;
+            size_t position = 0;
+            visit_elements([&](const JSONCursor& value) {
+                if (position++ == index) {
+                    result = value;
+                    return false;
+                }
+                return true;
+            });
+            return result;
+        }
+
+        bool exists() const { return !text.empty(); }
+
+        Type type() const {
+            if (!exists()) return Type::MISSING;
+            switch (text[0]) {
+                case '{': return Type::OBJECT;
+                case '[': return Type::ARRAY;
+                case '"': return Type::STRING;
+                case 't':
+                case 'f': return Type::BOOLEAN;
+                case 'n': return Type::NULL_VALUE;
+                default: return Type::NUMBER;
+            }
+        }
+
+        bool is_null() const { return type() == Type::NULL_VALUE; }
+
+        int64_t get_int64() const { return number().as_int64(); }
+        uint64_t get_uint64() const { return number().as_uint64(); }
+        double get_double() const { return number().as_double(); }
+
+        bool get_bool() const {
+            require_exists();
+            if (text.starts_with("true")) return true;
+            if (text.starts_with("false")) return false;
+            throw std::runtime_error("JSON value is not a boolean");
+        }
+
+        // Decoded string value. Strings without escapes are copied directly.
+        std::string get_string() const {
+            require_exists();
+            if (text[0] != '"') {
+                throw std::runtime_error("JSON value is not a string");
+            }
+            size_t end = skip_string(text, 0);
+            std::string_view contents = text.substr(1, end - 2);
+            if (contents.find('\\') == std::string_view::npos) {
+                return std::string(contents);
+            }
+            return JSON::parse(text.substr(0, end)).as_string();
+        }
+
+        // The exact text of this value.
+        std::string_view raw() const {
+            require_exists();
+            return text.substr(0, skip_value(text, 0));
+        }
+
+        // Parses this value, and everything under it, into a JSON tree.
+        JSON materialize() const {
+            return JSON::parse(raw());
+        }
+
+        // Number of elements of an array or members of an object.
+        size_t size() const {
+            size_t count = 0;
+            if (type() == Type::OBJECT) {
+                visit_members([&](std::string_view, const JSONCursor&) { ++count; return true; });
+            } else if (type() == Type::ARRAY) {
+                visit_elements([&](const JSONCursor&) { ++count; return true; });
+            } else {
+                throw std::runtime_error("JSON value is not an array or object");
+            }
+            return count;
+        }
+
+        // Calls fn(key, value) for each member of an object, in document order.
+        template<typename Fn>
+        void for_each_member(Fn&& fn) const {
+            require_exists();
+            if (text[0] != '{') {
+                throw std::runtime_error("JSON value is not an object");
+            }
+            visit_members([&](std::string_view raw_key, const JSONCursor& value) {
+                fn(decode_key(raw_key), value);
+                return true;
+            });
+        }
+
+        // Calls fn(value) for each element of an array.
+        template<typename Fn>
+        void for_each_element(Fn&& fn) const {
+            require_exists();
+            if (text[0] != '[') {
+                throw std::runtime_error("JSON value is not an array");
+            }
+            visit_elements([&](const JSONCursor& value) {
+                fn(value);
+                return true;
+            });
+        }
+
+    private:
+        // From the first character of the value to the end of the document;
+        // empty for a missing value.
+        std::string_view text;
+
+        void require_exists() const {
+            if (!exists()) {
+                throw std::runtime_error("JSON value not found");
+            }
+        }
+
+        JSON number() const {
+            require_exists();
+            char first = text[0];
+            if (first != '-' && (first < '0' || first > '9')) {
+                throw std::runtime_error("JSON value is not a number");
+            }
+            size_t end = 0;
+            bool is_float = false;
+            while (end < text.size()) {
+                char c = text[end];
+                if (c == '.' || c == 'e' || c == 'E') {
+                    is_float = true;
+                } else if ((c < '0' || c > '9') && c != '-' && c != '+') {
+                    break;
+                }
+                ++end;
+            }
+            return JSON::number_from_chars(text.substr(0, end), is_float);
+        }
+
+        // Calls visit(raw_key, value) per member until it returns false. raw_key
+        // is the key as written, without quotes and with escapes undecoded.
+        template<typename Visit>
+        void visit_members(Visit&& visit) const {
+            size_t index = skip_whitespace(text, 1);
+            if (index < text.size() && text[index] == '}') return;
+            while (true) {
+                if (index >= text.size() || text[index] != '"') {
+                    throw std::runtime_error("Expected string key in JSON object");
+                }
+                size_t key_end = skip_string(text, index);
+                std::string_view raw_key = text.substr(index + 1, key_end - index - 2);
+                index = skip_whitespace(text, key_end);
+                if (index >= text.size() || text[index] != ':') {
+                    throw std::runtime_error("Expected ':' in JSON object");
+                }
+                index = skip_whitespace(text, index + 1);
+                if (index >= text.size()) {
+                    throw std::runtime_error("Unexpected end of JSON input");
+                }
+                if (!visit(raw_key, JSONCursor(text.substr(index), 0))) return;
+                index = skip_whitespace(text, skip_value(text, index));
+                if (index < text.size() && text[index] == '}') return;
+                if (index >= text.size() || text[index] != ',') {
+                    throw std::runtime_error("Expected ',' or '}' in JSON object");
+                }
+                index = skip_whitespace(text, index + 1);
+            }
+        }
+
+        template<typename Visit>
+        void visit_elements(Visit&& visit) const {
+            size_t index = skip_whitespace(text, 1);
+            if (index < text.size() && text[index] == ']') return;
+            while (true) {
+                if (index >= text.size()) {
+                    throw std::runtime_error("Unexpected end of JSON input");
+                }
+                if (!visit(JSONCursor(text.substr(index), 0))) return;
+                index = skip_whitespace(text, skip_value(text, index));
+                if (index < text.size() && text[index] == ']') return;
+                if (index >= text.size() || text[index] != ',') {
+                    throw std::runtime_error("Expected ',' or ']' in JSON array");
+                }
+                index = skip_whitespace(text, index + 1);
+            }
+        }
+
+        // Wraps text already positioned at a value.
+        JSONCursor(std::string_view text, int) : text(text) {}
+
+        static bool key_equals(std::string_view raw_key, std::string_view key) {
+            if (raw_key.find('\\') == std::string_view::npos) {
+                return raw_key == key;
+            }
+            return decode_key(raw_key) == key;
+        }
+
+        static std::string decode_key(std::string_view raw_key) {
+            if (raw_key.find('\\') == std::string_view::npos) {
+                return std::string(raw_key);
+            }
+            return JSON::parse(std::string_view(raw_key.data() - 1, raw_key.size() + 2)).as_string();
+        }
+
+        static size_t skip_whitespace(std::string_view s, size_t index) {
+            while (index < s.size() && (s[index] == ' ' || s[index] == '\t' || s[index] == '\n' || s[index] == '\r')) {
+                ++index;
+            }
+            return index;
+        }
+
+        // Index just past the closing quote of the string opening at index. A
+        // quote preceded by an odd number of backslashes is escaped.
+        static size_t skip_string(std::string_view s, size_t index) {
+            const char* begin = s.data();
+            const char* end = s.data() + s.size();
+            const char* p = begin + index + 1;
+            while (true) {
+                p = static_cast<const char*>(std::memchr(p, '"', end - p));
+                if (!p) {
+                    throw std::runtime_error("Unterminated string");
+                }
+                const char* q = p;
+                while (q > begin + index + 1 && q[-1] == '\\') --q;
+                if ((p - q) % 2 == 0) {
+                    return p - begin + 1;
+                }
+                ++p;
+            }
+        }
+
+        // Index just past the value starting at index. Arrays and objects are
+        // skipped by counting brackets, jumping over strings whole.
+        static size_t skip_value(std::string_view s, size_t index) {
+            char first = s[index];
+            if (first == '"') {
+                return skip_string(s, index);
+            }
+            if (first != '{' && first != '[') {
+                while (index < s.size() && s[index] != ',' && s[index] != '}' && s[index] != ']' &&
+                       s[index] != ' ' && s[index] != '\t' && s[index] != '\n' && s[index] != '\r') {
+                    ++index;
+                }
+                return index;
+            }
+
+            size_t depth = 0;
+            while (index < s.size()) {
+                switch (s[index]) {
+                    case '"':
+                        index = skip_string(s, index);
+                        continue;
+                    case '{':
+                    case '[':
+                        ++depth;
+                        break;
+                    case '}':
+                    case ']':
+                        if (--depth == 0) return index + 1;
+                        break;
+                    default:
+                        break;
+                }
+                ++index;
+            }
+            throw std::runtime_error("Unterminated JSON value");
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,347 @@
+// Tomas Costantino
+
+#ifndef MULTIPART_H
+#define MULTIPART_H
+
+#include "http_lib.h"
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+
+namespace http {
+
+    // Extracts the boundary parameter from a multipart/form-data Content-Type.
+    inline std::optional<std::string> multipart_boundary(std::string_view content_type) {
+        auto semicolon = content_type.find(';');
+        if (!iequals(trim_view(content_type.substr(0, semicolon)), "multipart/form-data")) {
+            return std::nullopt;
+        }
+        while (semicolon != std::string_view::npos) {
+            content_type.remove_prefix(semicolon + 1);
+            semicolon = content_type.find(';');
+            std::string_view param = trim_view(content_type.substr(0, semicolon));
+            auto eq = param.find('=');
+            if (eq == std::string_view::npos || !iequals(trim_view(param.substr(0, eq)), "boundary")) continue;
+
+            std::string_view value = trim_view(param.substr(eq + 1));
+            if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+                value = value.substr(1, value.size() - 2);
+            }
+            if (value.empty() || value.size() > 70) return std::nullopt;
+            return std::string(value);
+        }
+        return std::nullopt;
+    }
+
+    // Returns the value of param (e.g. "name") in a header such as
+    // Content-Disposition: form-data; name="field"; filename="a.txt".
+    inline std::string header_parameter(std::string_view header, std::string_view param) {
+        size_t pos = 0;
+        while ((pos = header.find(';', pos)) != std::string_view::npos) {
+            ++pos;
+            std::string_view rest = header.substr(pos);
+            auto eq = rest.find('=');
+            if (eq == std::string_view::npos) break;
+            if (!iequals(trim_view(rest.substr(0, eq)), param)) continue;
+
+            rest = trim_view(rest.substr(eq + 1));
+            if (!rest.empty() && rest.front() == '"') {
+                std::string value;
+                for (size_t i = 1; i < rest.size() && rest[i] != '"'; ++i) {
+                    if (rest[i] == '\\' && i + 1 < rest.size()) ++i;
+                    value += rest[i];
+                }
+                return value;
+            }
+            return std::string(trim_view(rest.substr(0, rest.find(';'))));
+        }
+        return "";
+    }
+
+    // Incremental multipart/form-data parser (RFC 7578). Body bytes are fed in
+    // arbitrary chunks; part headers and data are reported through callbacks as
+    // soon as they are known, so memory use is bounded by the part header size
+    // and one delimiter length regardless of the upload size. Malformed input
+    // throws std::runtime_error.
+    class MultipartParser {
+    public:
+        struct Part {
+            std::map<std::string, std::string, CaseInsensitiveLess> headers;
+            std::string name;
+            std::string filename;
+            std::string content_type;
+
+            bool is_file() const { return !filename.empty(); }
+        };
+
+        struct Callbacks {
+            std::function<void(const Part&)> on_part_begin;
+            std::function<void(const Part&, std::string_view data)> on_part_data;
+            std::function<void(const Part&)> on_part_end;
+        };
+
+        MultipartParser(std::string_view boundary, Callbacks callbacks)
+                : delimiter("\r\n--" + std::string(boundary)), callbacks(std::move(callbacks)) {}
+
+        void feed(std::string_view chunk) {
+            if (state == State::DONE || chunk.empty()) return;
+            if (buffer.empty()) {
+                size_t used = process(chunk);
+                buffer.assign(chunk.substr(used));
+            } else {
+                buffer.append(chunk);
+                size_t used = process(buffer);
+                buffer.erase(0, used);
+            }
+            if (buffer.size() > max_header_size + delimiter.size()) {
+                throw std::runtime_error("Multipart headers too large");
+            }
+        }
+
+        // Call after the last chunk; throws if the closing boundary was not seen.
+        void finish() const {
+            if (state != State::DONE) {
+                throw std::runtime_error("Unterminated multipart body");
+            }
+        }
+
+        bool done() const { return state == State::DONE; }
+
+    private:
+        enum class State { PREAMBLE, AFTER_BOUNDARY, HEADERS, BODY, DONE };
+
+        static constexpr size_t max_header_size = 16 * 1024;
+
+        // "\r\n--boundary". The first boundary may appear without the leading CRLF.
+        std::string delimiter;
+        Callbacks callbacks;
+        State state = State::PREAMBLE;
+        std::string buffer;
+        Part part;
+
+        // Finds the next delimiter with memchr on its first byte, which glibc
+        // vectorizes; only candidate positions are compared in full.
+        size_t find_delimiter(std::string_view data, size_t from) const {
+            const char* begin = data.data();
+            const char* end = begin + data.size();
+            const char* p = begin + from;
+            while (p < end) {
+                p = static_cast<const char*>(std::memchr(p, delimiter[0], end - p));
+                if (!p) return std::string_view::npos;
+                size_t available = end - p;
+                size_t compare = std::min(available, delimiter.size());
+                if (std::memcmp(p, delimiter.data(), compare) == 0) {
+                    return p - begin;
+                }
+                ++p;
+            }
+            return std::string_view::npos;
+        }
+
+        size_t process(std::string_view data) {
+            size_t pos = 0;
+            while (pos < data.size()) {
+                switch (state) {
+                    case State::PREAMBLE: {
+                        // Allow the body to open with "--boundary" (no leading CRLF).
+                        std::string_view opening = std::string_view(delimiter).substr(2);
+                        if (pos == 0 && data.size() < opening.size() && opening.substr(0, data.size()) == data) {
+                            return 0;
+                        }
+                        if (data.substr(pos, opening.size()) == opening) {
+                            pos += opening.size();
+                            state = State::AFTER_BOUNDARY;
+                            break;
+                        }
+                        size_t found = find_delimiter(data, pos);
+                        if (found == std::string_view::npos) return data.size();
+                        if (found + delimiter.size() > data.size()) return found;
+                        pos = found + delimiter.size();
+                        state = State::AFTER_BOUNDARY;
+                        break;
+                    }
+                    case State::AFTER_BOUNDARY: {
+                        if (data.size() - pos < 2) return pos;
+                        std::string_view marker = data.substr(pos, 2);
+                        if (marker == "--") {
+                            state = State::DONE;
+                            return data.size();
+                        }
+                        // Transport padding (spaces/tabs) may follow the boundary.
+                        size_t line_end = data.find("\r\n", pos);
+                        if (line_end == std::string_view::npos) {
+                            if (data.size() - pos > 256) throw std::runtime_error("Invalid multipart boundary line");
+                            return pos;
+                        }
+                        if (!trim_view(data.substr(pos, line_end - pos)).empty()) {
+                            throw std::runtime_error("Invalid multipart boundary line");
+                        }
+                        pos = line_end + 2;
+                        part = Part{};
+                        state = State::HEADERS;
+                        break;
+                    }
+                    case State::HEADERS: {
+                        size_t line_end = data.find("\r\n", pos);
+                        if (line_end == std::string_view::npos) {
+                            if (data.size() - pos > max_header_size) throw std::runtime_error("Multipart headers too large");
+                            return pos;
+                        }
+                        std::string_view line = data.substr(pos, line_end - pos);
+                        pos = line_end + 2;
+                        if (line.empty()) {
+                            begin_part();
+                            state = State::BODY;
+                            break;
+                        }
+                        auto colon = line.find(':');
+                        if (colon == std::string_view::npos) throw std::runtime_error("Invalid multipart header");
+                        part.headers.insert_or_assign(std::string(trim_view(line.substr(0, colon))),
+                                                      std::string(trim_view(line.substr(colon + 1))));
+                        if (part.headers.size() > 64) throw std::runtime_error("Too many multipart headers");
+                        break;
+                    }
+                    case State::BODY: {
+                        size_t found = find_delimiter(data, pos);
+                        if (found == std::string_view::npos) {
+                            emit(data.substr(pos));
+                            return data.size();
+                        }
+                        if (found + delimiter.size() > data.size()) {
+                            // Possible delimiter cut by the chunk boundary: keep it.
+                            emit(data.substr(pos, found - pos));
+                            return found;
+                        }
+                        emit(data.substr(pos, found - pos));
+                        if (callbacks.on_part_end) callbacks.on_part_end(part);
+                        pos = found + delimiter.size();
+                        state = State::AFTER_BOUNDARY;
+                        break;
+                    }
+                    case State::DONE:
+                        return data.size();
+                }
+            }
+            return pos;
+        }
+
+        void begin_part() {
+            auto disposition = part.headers.find("Content-Disposition");
+            if (disposition != part.headers.end()) {
+                part.name = header_parameter(disposition->second, "name");
+                part.filename = header_parameter(disposition->second, "filename");
+            }
+            auto type = part.headers.find("Content-Type");
+            part.content_type = type != part.headers.end() ? type->second : "text/plain";
+            if (callbacks.on_part_begin) callbacks.on_part_begin(part);
+        }
+
+        void emit(std::string_view data) {
+            if (!data.empty() && callbacks.on_part_data) callbacks.on_part_data(part, data);
+        }
+    };
+
+    struct UploadedFile {
+        std::string name;
+        std::string filename;
+        std::string content_type;
+        std::string path;
+        size_t size = 0;
+    };
+
+    // Ready-made callbacks that stream file parts to temporary files and keep
+    // plain fields in memory (up to max_field_size each). At most max_parts
+    // fields and files are accepted per request. Temporary files are removed
+    // when the collector is destroyed unless release() is called.
+    class UploadCollector {
+    public:
+        explicit UploadCollector(std::string directory = "/tmp", size_t max_field_size = 64 * 1024,
+                                 size_t max_parts = 256)
+                : directory(std::move(directory)), max_field_size(max_field_size), max_parts(max_parts) {}
+
+        UploadCollector(const UploadCollector&) = delete;
+        UploadCollector& operator=(const UploadCollector&) = delete;
+
+        ~UploadCollector() {
+            close_current();
+            if (!released) {
+                for (const auto& file : files) unlink(file.path.c_str());
+            }
+        }
+
+        MultipartParser::Callbacks callbacks() {
+            return {
+                    [this](const MultipartParser::Part& part) { begin(part); },
+                    [this](const MultipartParser::Part& part, std::string_view data) { append(part, data); },
+                    [this](const MultipartParser::Part&) { close_current(); }
+            };
+        }
+
+        const std::map<std::string, std::string>& fields() const { return fields_; }
+        const std::vector<UploadedFile>& uploaded_files() const { return files; }
+
+        // Keeps the temporary files on disk; the caller becomes responsible for them.
+        void release() { released = true; }
+
+    private:
+        std::string directory;
+        size_t max_field_size;
+        size_t max_parts;
+        size_t parts = 0;
+        std::map<std::string, std::string> fields_;
+        std::vector<UploadedFile> files;
+        std::string* current_field = nullptr;
+        int current_fd = -1;
+        bool released = false;
+
+        void begin(const MultipartParser::Part& part) {
+            if (++parts > max_parts) {
+                throw std::runtime_error("Too many form parts");
+            }
+            if (!part.is_file()) {
+                current_field = &fields_[part.name];
+                current_field->clear();
+                return;
+            }
+            std::string path_template = directory + "/upload-XXXXXX";
+            current_fd = mkstemp(path_template.data());
+            if (current_fd < 0) throw std::runtime_error("Failed to create upload file");
+            files.push_back({part.name, part.filename, part.content_type, path_template, 0});
+        }
+
+        void append(const MultipartParser::Part&, std::string_view data) {
+            if (current_fd >= 0) {
+                while (!data.empty()) {
+                    ssize_t written = write(current_fd, data.data(), data.size());
+                    if (written < 0) {
+                        if (errno == EINTR) continue;
+                        throw std::runtime_error("Failed to write upload file");
+                    }
+                    data.remove_prefix(written);
+                    files.back().size += written;
+                }
+            } else if (current_field) {
+                if (current_field->size() + data.size() > max_field_size) {
+                    throw std::runtime_error("Form field too large");
+                }
+                current_field->append(data);
+            }
+        }
+
+        void close_current() {
+            if (current_fd >= 0) {
+                close(current_fd);
+                current_fd = -1;
+            }
+            current_field = nullptr;
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,301 @@
+// Tomas Costantino
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <charconv>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace http::trace {
+
+    // Phases of a request, recorded as Chrome trace "complete" events.
+    enum class Phase : uint8_t {
+        REQUEST,    // from parsing the request to sending its response, enclosing the phases below
+        PARSE,
+        ROUTE,
+        HANDLER,
+        COMPRESS,
+        SERIALIZE,
+        SEND
+    };
+
+    inline const char* phase_name(Phase phase) {
+        switch (phase) {
+            case Phase::REQUEST: return "request";
+            case Phase::PARSE: return "parse_request";
+            case Phase::ROUTE: return "route";
+            case Phase::HANDLER: return "handler";
+            case Phase::COMPRESS: return "compress";
+            case Phase::SERIALIZE: return "construct_response";
+            case Phase::SEND: return "send";
+        }
+        return "unknown";
+    }
+
+    // Raw timestamp: the TSC on x86, CLOCK_MONOTONIC elsewhere. Ticks are only
+    // converted to wall time when a trace is exported.
+    inline uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000u + ts.tv_nsec;
+#endif
+    }
+
+    struct Event {
+        uint64_t request;
+        uint64_t start;
+        uint64_t end;
+        Phase phase;
+    };
+
+    // Fixed-size ring of the most recent events recorded by one thread. Only
+    // the owning thread writes, without locking. A slot is claimed before it
+    // is written and published after, so a dump on another thread copies the
+    // published slots and then drops those the writer may have reclaimed
+    // meanwhile (a seqlock over the whole ring).
+    struct Buffer {
+        static constexpr size_t capacity = 16384;
+
+        struct Slot {
+            std::atomic<uint64_t> request{0};
+            std::atomic<uint64_t> start{0};
+            std::atomic<uint64_t> end{0};
+            std::atomic<uint8_t> phase{0};
+        };
+
+        std::unique_ptr<Slot[]> slots = std::make_unique<Slot[]>(capacity);
+        std::atomic<uint64_t> claimed{0};
+        std::atomic<uint64_t> written{0};
+        long thread_id = syscall(SYS_gettid);
+    };
+
+    struct State {
+        // Trace one request out of every sample_every; 0 disables tracing.
+        std::atomic<uint32_t> sample_every{0};
+        std::atomic<uint64_t> next_request{1};
+        // Guards buffers, which only changes when a thread records its first event.
+        std::mutex mutex;
+        std::vector<std::shared_ptr<Buffer>> buffers;
+        // Clock reference taken when tracing was enabled.
+        uint64_t origin_ticks = 0;
+        std::chrono::steady_clock::time_point origin_time;
+    };
+
+    inline State& state() {
+        static State instance;
+        return instance;
+    }
+
+    // Id of the sampled request being processed on this thread, 0 if none.
+    inline thread_local uint64_t current_request = 0;
+
+    inline Buffer& thread_buffer() {
+        thread_local std::shared_ptr<Buffer> buffer = [] {
+            auto created = std::make_shared<Buffer>();
+            std::lock_guard<std::mutex> lock(state().mutex);
+            state().buffers.push_back(created);
+            return created;
+        }();
+        return *buffer;
+    }
+
+    inline void record(uint64_t request, Phase phase, uint64_t start, uint64_t end) {
+        Buffer& buffer = thread_buffer();
+        uint64_t index = buffer.claimed.load(std::memory_order_relaxed);
+        buffer.claimed.store(index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        Buffer::Slot& slot = buffer.slots[index % Buffer::capacity];
+        slot.request.store(request, std::memory_order_relaxed);
+        slot.start.store(start, std::memory_order_relaxed);
+        slot.end.store(end, std::memory_order_relaxed);
+        slot.phase.store(static_cast<uint8_t>(phase), std::memory_order_relaxed);
+        buffer.written.store(index + 1, std::memory_order_release);
+    }
+
+    inline void record(Phase phase, uint64_t start, uint64_t end) {
+        record(current_request, phase, start, end);
+    }
+
+    inline void enable(uint32_t sample_every = 1) {
+        State& s = state();
+        if (s.sample_every.load() == 0) {
+            s.origin_ticks = now();
+            s.origin_time = std::chrono::steady_clock::now();
+        }
+        s.sample_every.store(sample_every);
+    }
+
+    inline void disable() {
+        state().sample_every.store(0);
+    }
+
+    inline bool enabled() {
+        return state().sample_every.load(std::memory_order_relaxed) != 0;
+    }
+
+    // One request's sampling decision. An id of 0 means it is not traced.
+    struct RequestTrace {
+        uint64_t id = 0;
+        uint64_t start = 0;
+    };
+
+    // Decides whether a new request is sampled. With tracing disabled this
+    // costs a single relaxed load and branch.
+    inline RequestTrace begin_request() {
+        uint32_t every = state().sample_every.load(std::memory_order_relaxed);
+        if (every == 0) [[likely]] return {};
+        thread_local uint32_t counter = 0;
+        if (++counter < every) return {};
+        counter = 0;
+        return {state().next_request.fetch_add(1, std::memory_order_relaxed), now()};
+    }
+
+    // Records the REQUEST event of a sampled request; later calls do nothing.
+    inline void end_request(RequestTrace& request) {
+        if (request.id) {
+            record(request.id, Phase::REQUEST, request.start, now());
+            request.id = 0;
+        }
+    }
+
+    // Makes request current on this thread for its lifetime, so Spans opened
+    // meanwhile are recorded under it. Re-entered wherever the request
+    // resumes, e.g. when an asynchronous handler responds.
+    class Scope {
+    public:
+        explicit Scope(uint64_t request) : previous(current_request) {
+            current_request = request;
+        }
+
+        ~Scope() {
+            current_request = previous;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        uint64_t previous;
+    };
+
+    // Times one phase of the current sampled request; does nothing (beyond one
+    // test of current_request) when the request is not being traced.
+    class Span {
+    public:
+        explicit Span(Phase phase) : phase(phase), start(current_request ? now() : 0) {}
+
+        ~Span() { end(); }
+
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+
+        // Ends the span early; later calls and the destructor do nothing.
+        void end() {
+            if (start) {
+                record(phase, start, now());
+                start = 0;
+            }
+        }
+
+    private:
+        Phase phase;
+        uint64_t start;
+    };
+
+    // Exports every buffered event in the Chrome trace-event JSON format, which
+    // chrome://tracing and ui.perfetto.dev load directly.
+    inline std::string chrome_trace_json() {
+        State& s = state();
+        std::vector<std::shared_ptr<Buffer>> buffers;
+        {
+            std::lock_guard<std::mutex> lock(s.mutex);
+            buffers = s.buffers;
+        }
+
+        // Calibrate ticks against steady_clock over the whole tracing period.
+        uint64_t ticks = now() - s.origin_ticks;
+        double elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - s.origin_time).count();
+        double us_per_tick = ticks > 0 && elapsed_us > 0 ? elapsed_us / static_cast<double>(ticks) : 0.001;
+
+        std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        char number[64];
+        auto append_number = [&](double value) {
+            auto result = std::to_chars(number, number + sizeof(number), value, std::chars_format::fixed, 3);
+            out.append(number, result.ptr);
+        };
+        auto append_integer = [&](uint64_t value) {
+            auto result = std::to_chars(number, number + sizeof(number), value);
+            out.append(number, result.ptr);
+        };
+
+        for (const auto& buffer : buffers) {
+            std::vector<Event> events;
+            uint64_t before = buffer->written.load(std::memory_order_acquire);
+            uint64_t first_index = before - std::min<uint64_t>(before, Buffer::capacity);
+            events.reserve(before - first_index);
+            for (uint64_t i = first_index; i < before; ++i) {
+                const Buffer::Slot& slot = buffer->slots[i % Buffer::capacity];
+                events.push_back(Event{slot.request.load(std::memory_order_relaxed),
+                                       slot.start.load(std::memory_order_relaxed),
+                                       slot.end.load(std::memory_order_relaxed),
+                                       static_cast<Phase>(slot.phase.load(std::memory_order_relaxed))});
+            }
+            // The owner may have wrapped around meanwhile; slots it has claimed
+            // again since are dropped.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t after = buffer->claimed.load(std::memory_order_relaxed);
+            if (after >= Buffer::capacity && after - Buffer::capacity > first_index) {
+                size_t stale = std::min<uint64_t>(after - Buffer::capacity - first_index, events.size());
+                events.erase(events.begin(), events.begin() + stale);
+            }
+            long thread_id = buffer->thread_id;
+
+            for (const Event& event : events) {
+                if (event.start < s.origin_ticks) continue;
+                out += first ? "" : ",";
+                first = false;
+                out += "{\"name\":\"";
+                out += phase_name(event.phase);
+                out += "\",\"cat\":\"http\",\"ph\":\"X\",\"ts\":";
+                append_number(static_cast<double>(event.start - s.origin_ticks) * us_per_tick);
+                out += ",\"dur\":";
+                append_number(static_cast<double>(event.end - event.start) * us_per_tick);
+                out += ",\"pid\":";
+                append_integer(static_cast<uint64_t>(getpid()));
+                out += ",\"tid\":";
+                append_integer(static_cast<uint64_t>(thread_id));
+                out += ",\"args\":{\"request\":";
+                append_integer(event.request);
+                out += "}}";
+            }
+        }
+        out += "]}";
+        return out;
+    }
+
+    // Set from a signal handler to ask the server loop for a dump.
+    inline volatile std::sig_atomic_t dump_requested = 0;
+
+    inline void request_dump(int) {
+        dump_requested = 1;
+    }
+}
+
+#endif
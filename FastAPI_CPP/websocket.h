@@ -0,0 +1,446 @@
+// Tomas Costantino
+
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include "http_lib.h"
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace http::ws {
+
+    enum class Opcode : uint8_t {
+        CONTINUATION = 0x0,
+        TEXT = 0x1,
+        BINARY = 0x2,
+        CLOSE = 0x8,
+        PING = 0x9,
+        PONG = 0xa
+    };
+
+    enum CloseCode : uint16_t {
+        NORMAL = 1000,
+        GOING_AWAY = 1001,
+        PROTOCOL_ERROR = 1002,
+        UNSUPPORTED_DATA = 1003,
+        NO_STATUS = 1005,
+        ABNORMAL = 1006,
+        INVALID_PAYLOAD = 1007,
+        MESSAGE_TOO_BIG = 1009,
+        INTERNAL_ERROR = 1011
+    };
+
+    struct Message {
+        Opcode opcode;
+        std::string data;
+
+        bool is_text() const { return opcode == Opcode::TEXT; }
+        bool is_binary() const { return opcode == Opcode::BINARY; }
+    };
+
+    // SHA-1 is only needed for the Sec-WebSocket-Accept handshake value.
+    inline std::string sha1(std::string_view input) {
+        uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+        std::string message(input);
+        uint64_t bit_length = static_cast<uint64_t>(input.size()) * 8;
+        message += static_cast<char>(0x80);
+        while (message.size() % 64 != 56) message += '\0';
+        for (int i = 7; i >= 0; --i) message += static_cast<char>((bit_length >> (i * 8)) & 0xff);
+
+        auto rotl = [](uint32_t value, int bits) { return (value << bits) | (value >> (32 - bits)); };
+        for (size_t chunk = 0; chunk < message.size(); chunk += 64) {
+            uint32_t w[80];
+            for (int i = 0; i < 16; ++i) {
+                const auto* p = reinterpret_cast<const unsigned char*>(message.data() + chunk + i * 4);
+                w[i] = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+            }
+            for (int i = 16; i < 80; ++i) w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+            for (int i = 0; i < 80; ++i) {
+                uint32_t f, k;
+                if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+                else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+                else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+                else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+                uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+                e = d; d = c; c = rotl(b, 30); b = a; a = temp;
+            }
+            h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+        }
+
+        std::string digest;
+        for (uint32_t word : h) {
+            for (int i = 3; i >= 0; --i) digest += static_cast<char>((word >> (i * 8)) & 0xff);
+        }
+        return digest;
+    }
+
+    inline std::string accept_key(std::string_view client_key) {
+        std::string input(client_key);
+        input += "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+        return base64_encode(sha1(input));
+    }
+
+    inline bool is_upgrade_request(const Request& request) {
+        return request.method == Method::GET &&
+               header_has_token(request.get_header("Upgrade"), "websocket") &&
+               header_has_token(request.get_header("Connection"), "upgrade") &&
+               request.get_header("Sec-WebSocket-Version") == "13" &&
+               request.has_header("Sec-WebSocket-Key");
+    }
+
+    inline std::string handshake_response(const Request& request) {
+        std::string response = "HTTP/1.1 101 Switching Protocols\r\n"
+                               "Upgrade: websocket\r\n"
+                               "Connection: Upgrade\r\n"
+                               "Sec-WebSocket-Accept: ";
+        response += accept_key(request.get_header("Sec-WebSocket-Key"));
+        response += "\r\n\r\n";
+        return response;
+    }
+
+    // XORs data with the 4-byte masking key. offset is the position of data[0]
+    // within the payload, so a payload can be unmasked in several pieces.
+    inline void unmask(char* data, size_t length, const uint8_t key[4], size_t offset = 0) {
+        uint8_t rotated[4];
+        for (int i = 0; i < 4; ++i) rotated[i] = key[(offset + i) & 3];
+
+        uint32_t key32;
+        std::memcpy(&key32, rotated, 4);
+        uint64_t key64 = (static_cast<uint64_t>(key32) << 32) | key32;
+        size_t i = 0;
+
+#if defined(__AVX2__)
+        __m256i key256 = _mm256_set1_epi32(static_cast<int>(key32));
+        for (; i + 32 <= length; i += 32) {
+            __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), _mm256_xor_si256(block, key256));
+        }
+#endif
+#if defined(__SSE2__)
+        __m128i key128 = _mm_set1_epi32(static_cast<int>(key32));
+        for (; i + 16 <= length; i += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), _mm_xor_si128(block, key128));
+        }
+#elif defined(__ARM_NEON)
+        uint8x16_t key128 = vreinterpretq_u8_u32(vdupq_n_u32(key32));
+        for (; i + 16 <= length; i += 16) {
+            uint8_t* p = reinterpret_cast<uint8_t*>(data + i);
+            vst1q_u8(p, veorq_u8(vld1q_u8(p), key128));
+        }
+#endif
+        for (; i + 8 <= length; i += 8) {
+            uint64_t block;
+            std::memcpy(&block, data + i, 8);
+            block ^= key64;
+            std::memcpy(data + i, &block, 8);
+        }
+        for (; i < length; ++i) {
+            data[i] ^= static_cast<char>(rotated[i & 3]);
+        }
+    }
+
+    inline bool is_valid_utf8(std::string_view text) {
+        size_t i = 0;
+        while (i < text.size()) {
+            unsigned char c = static_cast<unsigned char>(text[i]);
+            if (c < 0x80) {
+                ++i;
+                continue;
+            }
+            size_t extra;
+            uint32_t codepoint;
+            if ((c & 0xe0) == 0xc0) { extra = 1; codepoint = c & 0x1f; }
+            else if ((c & 0xf0) == 0xe0) { extra = 2; codepoint = c & 0x0f; }
+            else if ((c & 0xf8) == 0xf0) { extra = 3; codepoint = c & 0x07; }
+            else return false;
+
+            if (i + extra >= text.size()) return false;
+            for (size_t j = 1; j <= extra; ++j) {
+                unsigned char next = static_cast<unsigned char>(text[i + j]);
+                if ((next & 0xc0) != 0x80) return false;
+                codepoint = (codepoint << 6) | (next & 0x3f);
+            }
+            // Reject overlong forms, surrogates and values beyond U+10FFFF.
+            if ((extra == 1 && codepoint < 0x80) || (extra == 2 && codepoint < 0x800) ||
+                (extra == 3 && codepoint < 0x10000) || codepoint > 0x10ffff ||
+                (codepoint >= 0xd800 && codepoint <= 0xdfff)) {
+                return false;
+            }
+            i += extra + 1;
+        }
+        return true;
+    }
+
+    // Appends one unmasked (server-to-client) frame to out.
+    inline void write_frame(std::string& out, Opcode opcode, std::string_view payload, bool fin = true) {
+        out += static_cast<char>((fin ? 0x80 : 0x00) | static_cast<uint8_t>(opcode));
+        if (payload.size() < 126) {
+            out += static_cast<char>(payload.size());
+        } else if (payload.size() <= 0xffff) {
+            out += static_cast<char>(126);
+            out += static_cast<char>((payload.size() >> 8) & 0xff);
+            out += static_cast<char>(payload.size() & 0xff);
+        } else {
+            out += static_cast<char>(127);
+            for (int i = 7; i >= 0; --i) out += static_cast<char>((static_cast<uint64_t>(payload.size()) >> (i * 8)) & 0xff);
+        }
+        out += payload;
+    }
+
+    class WebSocket;
+
+    // Callbacks for one WebSocket route. Only on_message is required.
+    struct Handler {
+        std::function<void(WebSocket&)> on_open;
+        std::function<void(WebSocket&, const Message&)> on_message;
+        std::function<void(WebSocket&, uint16_t code)> on_close;
+    };
+
+    // Server side of an upgraded connection (RFC 6455). The server feeds it the
+    // bytes read from the socket; frames it sends are appended to the
+    // connection's output buffer and the owner is notified to flush them.
+    // Handlers may keep a shared_ptr/weak_ptr to push messages later; once the
+    // connection is gone is_open() turns false and sends are dropped.
+    class WebSocket : public std::enable_shared_from_this<WebSocket> {
+    public:
+        WebSocket(std::shared_ptr<const Handler> handler, std::string path)
+                : handler(std::move(handler)), path_(std::move(path)) {}
+
+        // Called by the server to bind the socket output; notify requests a flush.
+        void attach(std::string* output, std::function<void()> notify) {
+            out = output;
+            notify_write = std::move(notify);
+        }
+
+        const std::string& path() const { return path_; }
+
+        bool is_open() const { return out != nullptr && !close_sent; }
+
+        // True once a close frame has been sent; the peer should answer with its
+        // own and the server drops the connection if it does not.
+        bool closing() const { return close_sent; }
+
+        void send_text(std::string_view text) { send(Opcode::TEXT, text); }
+
+        void send_binary(std::string_view data) { send(Opcode::BINARY, data); }
+
+        void ping(std::string_view payload = {}) { send(Opcode::PING, payload.substr(0, 125)); }
+
+        void close(uint16_t code = NORMAL, std::string_view reason = {}) {
+            if (!is_open()) return;
+            std::string payload;
+            payload += static_cast<char>((code >> 8) & 0xff);
+            payload += static_cast<char>(code & 0xff);
+            payload += reason.substr(0, 123);
+            write_frame(*out, Opcode::CLOSE, payload);
+            close_sent = true;
+            if (notify_write) notify_write();
+        }
+
+        // Consumes complete frames and returns how many bytes were used. Frames are
+        // unmasked in place, so data must be the server's mutable input buffer.
+        size_t feed(char* data, size_t size) {
+            size_t consumed = 0;
+            while (!close_received && out) {
+                size_t available = size - consumed;
+                if (available < 2) break;
+
+                auto* header = reinterpret_cast<const uint8_t*>(data + consumed);
+                bool fin = header[0] & 0x80;
+                auto opcode = static_cast<Opcode>(header[0] & 0x0f);
+                bool masked = header[1] & 0x80;
+                uint64_t length = header[1] & 0x7f;
+                size_t header_size = 2;
+
+                if (header[0] & 0x70) return fail(PROTOCOL_ERROR, size);
+                if (!masked) return fail(PROTOCOL_ERROR, size);
+
+                if (length == 126) {
+                    if (available < 4) break;
+                    length = (uint64_t(header[2]) << 8) | header[3];
+                    header_size = 4;
+                } else if (length == 127) {
+                    if (available < 10) break;
+                    length = 0;
+                    for (int i = 0; i < 8; ++i) length = (length << 8) | header[2 + i];
+                    header_size = 10;
+                }
+                if (length > max_message_size) return fail(MESSAGE_TOO_BIG, size);
+
+                header_size += 4;
+                if (available < header_size + length) break;
+
+                uint8_t key[4];
+                std::memcpy(key, data + consumed + header_size - 4, 4);
+                char* payload = data + consumed + header_size;
+                unmask(payload, length, key);
+                consumed += header_size + length;
+
+                if (!handle_frame(fin, opcode, std::string_view(payload, length))) {
+                    return size;
+                }
+            }
+            return consumed;
+        }
+
+        // Called by the server when the TCP connection goes away.
+        void detach(uint16_t code = ABNORMAL) {
+            if (!out) return;
+            out = nullptr;
+            notify_write = nullptr;
+            if (!closed_notified) {
+                closed_notified = true;
+                if (handler->on_close) handler->on_close(*this, code);
+            }
+        }
+
+        void opened() {
+            if (handler->on_open) handler->on_open(*this);
+        }
+
+        // True once both sides have exchanged close frames (or a protocol error
+        // occurred) and the TCP connection can be closed after flushing.
+        bool finished() const { return close_received || failed; }
+
+    private:
+        static constexpr size_t max_message_size = 16 * 1024 * 1024;
+
+        std::shared_ptr<const Handler> handler;
+        std::string path_;
+        std::string* out = nullptr;
+        std::function<void()> notify_write;
+
+        Opcode fragment_opcode = Opcode::CONTINUATION;
+        std::string fragments;
+        bool close_sent = false;
+        bool close_received = false;
+        bool closed_notified = false;
+        bool failed = false;
+
+        void send(Opcode opcode, std::string_view payload) {
+            if (!is_open()) return;
+            write_frame(*out, opcode, payload);
+            if (notify_write) notify_write();
+        }
+
+        size_t fail(uint16_t code, size_t size) {
+            close(code);
+            failed = true;
+            notify_closed(code);
+            return size;
+        }
+
+        void notify_closed(uint16_t code) {
+            if (!closed_notified) {
+                closed_notified = true;
+                if (handler->on_close) handler->on_close(*this, code);
+            }
+        }
+
+        // Returns false if the frame ended the connection.
+        bool handle_frame(bool fin, Opcode opcode, std::string_view payload) {
+            switch (opcode) {
+                case Opcode::PING:
+                case Opcode::PONG:
+                case Opcode::CLOSE:
+                    if (!fin || payload.size() > 125) {
+                        fail(PROTOCOL_ERROR, 0);
+                        return false;
+                    }
+                    return handle_control(opcode, payload);
+                case Opcode::TEXT:
+                case Opcode::BINARY:
+                    if (fragment_opcode != Opcode::CONTINUATION) {
+                        fail(PROTOCOL_ERROR, 0);
+                        return false;
+                    }
+                    if (fin) {
+                        return deliver(opcode, payload);
+                    }
+                    fragment_opcode = opcode;
+                    fragments.assign(payload);
+                    return true;
+                case Opcode::CONTINUATION:
+                    if (fragment_opcode == Opcode::CONTINUATION) {
+                        fail(PROTOCOL_ERROR, 0);
+                        return false;
+                    }
+                    if (fragments.size() + payload.size() > max_message_size) {
+                        fail(MESSAGE_TOO_BIG, 0);
+                        return false;
+                    }
+                    fragments += payload;
+                    if (fin) {
+                        Opcode message_opcode = fragment_opcode;
+                        fragment_opcode = Opcode::CONTINUATION;
+                        std::string message = std::move(fragments);
+                        fragments.clear();
+                        return deliver(message_opcode, message);
+                    }
+                    return true;
+                default:
+                    fail(PROTOCOL_ERROR, 0);
+                    return false;
+            }
+        }
+
+        bool handle_control(Opcode opcode, std::string_view payload) {
+            if (opcode == Opcode::PING) {
+                send(Opcode::PONG, payload);
+                return true;
+            }
+            if (opcode == Opcode::PONG) {
+                return true;
+            }
+
+            uint16_t code = NO_STATUS;
+            if (payload.size() == 1) {
+                fail(PROTOCOL_ERROR, 0);
+                return false;
+            }
+            if (payload.size() >= 2) {
+                code = (static_cast<uint8_t>(payload[0]) << 8) | static_cast<uint8_t>(payload[1]);
+                bool valid_code = (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011) ||
+                                  (code >= 3000 && code <= 4999);
+                if (!valid_code) {
+                    fail(PROTOCOL_ERROR, 0);
+                    return false;
+                }
+                if (!is_valid_utf8(payload.substr(2))) {
+                    fail(INVALID_PAYLOAD, 0);
+                    return false;
+                }
+            }
+            close_received = true;
+            close(code == NO_STATUS ? static_cast<uint16_t>(NORMAL) : code);
+            notify_closed(code);
+            return false;
+        }
+
+        bool deliver(Opcode opcode, std::string_view payload) {
+            if (opcode == Opcode::TEXT && !is_valid_utf8(payload)) {
+                fail(INVALID_PAYLOAD, 0);
+                return false;
+            }
+            Message message{opcode, std::string(payload)};
+            handler->on_message(*this, message);
+            return true;
+        }
+    };
+}
+
+#endif
@@ -4,23 +4,19 @@
 int main() {
     fastapi_cpp::FastAPI app;
 
-    app.get("/", [](const fastapi_cpp::Request& request, const std::map<std::string, std::string>& params) {
-        return http::HTTP_200_OK(http::JSON::object({{"message", "Welcome"}}));
-    });
+    app.get_static("/", http::HTTP_200_OK(http::JSON::object({{"message", "Welcome"}})));
 
-    app.get("/param_query", [](const fastapi_cpp::Request& request, const std::map<std::string, std::string>& params) {
+    app.get("/param_query", [](const fastapi_cpp::Request& request, const fastapi_cpp::Params& params) {
         http::JSON::Object response_data;
         for (const auto& [key, value] : params) {
-            response_data[key] = value;
+            response_data[std::string(key)] = value;
         }
         return http::HTTP_200_OK(response_data);
     });
 
-    app.get("/echo", [](const fastapi_cpp::Request& request, const std::map<std::string, std::string>& params) {
-        return http::HTTP_200_OK(http::JSON::object({{"message", "Echo"}}));
-    });
+    app.get_static("/echo", http::HTTP_200_OK(http::JSON::object({{"message", "Echo"}})));
 
-    app.post("/echo", [](const fastapi_cpp::Request& request, const std::map<std::string, std::string>& params) {
+    app.post("/echo", [](const fastapi_cpp::Request& request, const fastapi_cpp::Params& params) {
         try {
             http::JSON parsed_json = http::JSON::parse(request.body);
             std::map<std::string, http::JSON> parsed_body = http::JSON::json_to_map(parsed_json);
@@ -29,10 +25,8 @@ int main() {
             for (const auto& [key, value] : parsed_body) {
                 if (std::holds_alternative<std::string>(value.get_value())) {
                     response_body[key] = std::get<std::string>(value.get_value());
-                } else if (std::holds_alternative<int>(value.get_value())) {
-                    response_body[key] = std::get<int>(value.get_value());
-                } else if (std::holds_alternative<double>(value.get_value())) {
-                    response_body[key] = std::get<double>(value.get_value());
+                } else if (value.is_number()) {
+                    response_body[key] = value;
                 } else if (std::holds_alternative<bool>(value.get_value())) {
                     response_body[key] = std::get<bool>(value.get_value());
                 } else if (std::holds_alternative<std::nullptr_t>(value.get_value())) {
@@ -47,15 +41,84 @@ int main() {
         }
     });
 
-    app.get("/test", [](const fastapi_cpp::Request& request, const std::map<std::string, std::string>& params) {
-        return http::HTTP_200_OK(http::JSON::object({{"message", "Testing"}}));
+    // Reads two fields of a possibly large body without parsing the rest.
+    app.post("/user", [](const fastapi_cpp::Request& request, const fastapi_cpp::Params& params) {
+        try {
+            http::JSONCursor doc(request.body);
+            http::JSONCursor user = doc["user"];
+            int64_t id = user["id"].get_int64();
+            std::string name = user["name"].get_string();
+            return http::HTTP_200_OK(http::JSON::object({{"id", id}, {"name", name}}));
+        } catch (const std::exception& e) {
+            return http::HTTP_400_BAD_REQUEST(http::JSON::object({{"error", e.what()}}));
+        }
     });
 
-    app.get("/echo/{echo}", [](const fastapi_cpp::Request& request, const std::map<std::string, std::string>& params) {
+    app.get_static("/test", http::HTTP_200_OK(http::JSON::object({{"message", "Testing"}})));
+
+    app.get("/echo/{echo}", [](const fastapi_cpp::Request& request, const fastapi_cpp::Params& params) {
         auto to_echo = params.at("echo");
         return http::HTTP_200_OK(http::JSON::object({{"Echo route", to_echo}}));
     });
 
+    app.post_stream("/upload", [](const fastapi_cpp::Request& request, const fastapi_cpp::Params& params) {
+        auto boundary = http::multipart_boundary(request.get_header("Content-Type"));
+        if (!boundary) {
+            // Reads and discards the body, then rejects it.
+            return fastapi_cpp::BodyStream{
+                    [](std::string_view) {},
+                    [] { return http::HTTP_400_BAD_REQUEST(http::JSON::object({{"error", "Expected multipart/form-data"}})); }
+            };
+        }
+        auto collector = std::make_shared<http::UploadCollector>();
+        auto parser = std::make_shared<http::MultipartParser>(*boundary, collector->callbacks());
+
+        return fastapi_cpp::BodyStream{
+                [parser](std::string_view chunk) { parser->feed(chunk); },
+                [parser, collector]() {
+                    parser->finish();
+                    http::JSON::Object response_body;
+                    for (const auto& [name, value] : collector->fields()) {
+                        response_body[name] = value;
+                    }
+                    for (const auto& file : collector->uploaded_files()) {
+                        response_body[file.name] = file.filename + " (" + std::to_string(file.size) + " bytes)";
+                    }
+                    return http::HTTP_200_OK(http::JSON(response_body));
+                }
+        };
+    });
+
+    // Calls two routes of this same server concurrently without blocking the loop.
+    http::Client client(app.event_loop());
+    app.get_async("/aggregate", [&client](const fastapi_cpp::Request& request, const fastapi_cpp::Params& params,
+                                          fastapi_cpp::Responder respond) {
+        std::vector<http::Request> requests(2);
+        requests[0].uri = "http://127.0.0.1:8000/test";
+        requests[1].uri = "http://127.0.0.1:8000/echo/aggregate";
+        client.send_all(std::move(requests), [respond](std::vector<http::Response> responses) {
+            // This runs on the event loop: an exception here would leave the
+            // request unanswered, so every failure becomes a 502.
+            http::JSON::Array results;
+            try {
+                for (const auto& response : responses) {
+                    if (response.status != http::HttpStatus::OK) {
+                        throw std::runtime_error("Upstream returned " + std::to_string(static_cast<int>(response.status)));
+                    }
+                    results.push_back(http::JSON::parse(response.body));
+                }
+            } catch (const std::exception& e) {
+                respond(http::custom_response(http::HttpStatus::BAD_GATEWAY, http::JSON::object({{"error", e.what()}})));
+                return;
+            }
+            respond(http::HTTP_200_OK(http::JSON(results)));
+        });
+    });
+
+    app.websocket("/ws", [](http::ws::WebSocket& ws, const http::ws::Message& message) {
+        ws.send_text("Echo: " + message.data);
+    });
+
     app.run(8000);
 
     return 0;
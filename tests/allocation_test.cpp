@@ -0,0 +1,108 @@
+// Tomas Costantino
+
+// Counts global operator new calls while a keep-alive client sends plain GET
+// requests, and fails if a request costs more than the budget below. Request
+// parsing, route params and response serialization draw from the connection's
+// arena; what remains is the handler's JSON and Response and the Responder.
+
+#include "../FastAPI_CPP/FastAPI_CPP.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static std::atomic<unsigned long> allocations{0};
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+    constexpr int warmup_requests = 100;
+    constexpr int measured_requests = 1000;
+    constexpr double max_allocations_per_request = 7.0;
+
+    int connect_to(const char* path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+        for (int attempt = 0; attempt < 200; ++attempt) {
+            int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) return fd;
+            close(fd);
+            usleep(10000);
+        }
+        return -1;
+    }
+
+    // Sends one request and reads its response into a stack buffer, so the
+    // client side adds nothing to the count.
+    bool round_trip(int fd) {
+        static constexpr char request[] = "GET /items/42 HTTP/1.1\r\nHost: localhost\r\nAccept: */*\r\n\r\n";
+        if (send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(request) - 1)) {
+            return false;
+        }
+        char buffer[4096];
+        size_t received = 0;
+        while (true) {
+            ssize_t n = recv(fd, buffer + received, sizeof(buffer) - received, 0);
+            if (n <= 0) return false;
+            received += n;
+            std::string_view response(buffer, received);
+            auto header_end = response.find("\r\n\r\n");
+            if (header_end == std::string_view::npos) continue;
+            auto length = response.find("Content-Length: ");
+            if (length == std::string_view::npos || !response.starts_with("HTTP/1.1 200")) return false;
+            size_t body = std::strtoul(buffer + length + 16, nullptr, 10);
+            if (received >= header_end + 4 + body) return received == header_end + 4 + body;
+        }
+    }
+}
+
+int main() {
+    std::cout.setstate(std::ios::failbit);
+
+    char path[64];
+    std::snprintf(path, sizeof(path), "/tmp/fastapi_allocation_test-%d.sock", static_cast<int>(getpid()));
+
+    fastapi_cpp::FastAPI app;
+    app.get("/items/{id}", [](const fastapi_cpp::Request&, const fastapi_cpp::Params& params) {
+        return http::HTTP_200_OK(http::JSON::object({{"id", params.find("id")->second}}));
+    });
+
+    fastapi_cpp::ServerConfig config;
+    config.unix_path = path;
+    std::thread server([&] { app.run(config); });
+
+    int fd = connect_to(path);
+    bool ok = fd >= 0;
+    for (int i = 0; ok && i < warmup_requests; ++i) ok = round_trip(fd);
+    unsigned long before = allocations.load();
+    for (int i = 0; ok && i < measured_requests; ++i) ok = round_trip(fd);
+    unsigned long after = allocations.load();
+
+    if (fd >= 0) close(fd);
+    app.drain();
+    server.join();
+
+    if (!ok) {
+        std::cerr << "Request failed" << std::endl;
+        return 1;
+    }
+    double per_request = static_cast<double>(after - before) / measured_requests;
+    std::cerr << "Global allocations per request: " << per_request << std::endl;
+    if (per_request > max_allocations_per_request) {
+        std::cerr << "Expected at most " << max_allocations_per_request << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+// Tomas Costantino
+
+// HEAD requests are answered by the GET route of the same path, with the GET
+// response's status and Content-Length but no body.
+
+#include "../FastAPI_CPP/FastAPI_CPP.h"
+#include <cstdio>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+    int connect_to(const std::string& path) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::snprintf(address.sun_path, sizeof(address.sun_path), "%s", path.c_str());
+        for (int attempt = 0; attempt < 200; ++attempt) {
+            int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) return fd;
+            close(fd);
+            usleep(10000);
+        }
+        return -1;
+    }
+
+    // Sends one request with "Connection: close" and returns everything the
+    // server sent back.
+    std::string fetch(const std::string& path, const std::string& method, const std::string& target) {
+        int fd = connect_to(path);
+        if (fd < 0) return "";
+        std::string request = method + " " + target + " HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n";
+        send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+        std::string response;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+            response.append(buffer, n);
+        }
+        close(fd);
+        return response;
+    }
+
+    std::string header_value(const std::string& response, const std::string& name) {
+        auto start = response.find("\r\n" + name + ": ");
+        if (start == std::string::npos) return "";
+        start += name.size() + 4;
+        return response.substr(start, response.find("\r\n", start) - start);
+    }
+
+    int failures = 0;
+
+    void check_head(const std::string& path, const std::string& target, const std::string& status) {
+        std::string get = fetch(path, "GET", target);
+        std::string head = fetch(path, "HEAD", target);
+        std::string expected_length = header_value(get, "Content-Length");
+        bool ok = head.starts_with("HTTP/1.1 " + status) && head.ends_with("\r\n\r\n") &&
+                  !expected_length.empty() && header_value(head, "Content-Length") == expected_length;
+        if (!ok) {
+            std::cerr << "HEAD " << target << " failed:\n" << head << std::endl;
+            ++failures;
+        }
+    }
+}
+
+int main() {
+    std::cout.setstate(std::ios::failbit);
+
+    std::string path = "/tmp/fastapi_head_test-" + std::to_string(getpid()) + ".sock";
+
+    fastapi_cpp::FastAPI app;
+    app.get_static("/static", http::HTTP_200_OK(http::JSON::object({{"message", "Testing"}})));
+    app.get("/items/{id}", [](const fastapi_cpp::Request&, const fastapi_cpp::Params& params) {
+        return http::HTTP_200_OK(http::JSON::object({{"id", params.find("id")->second}}));
+    });
+
+    fastapi_cpp::ServerConfig config;
+    config.unix_path = path;
+    std::thread server([&] { app.run(config); });
+
+    check_head(path, "/static", "200");
+    check_head(path, "/items/42", "200");
+    check_head(path, "/missing", "404");
+
+    app.drain();
+    server.join();
+    return failures == 0 ? 0 : 1;
+}